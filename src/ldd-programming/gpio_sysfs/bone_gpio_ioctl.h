@@ -0,0 +1,139 @@
+#ifndef BONE_GPIO_IOCTL_H
+#define BONE_GPIO_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// Character device for the whole bone_gpio_devs node
+#define BONE_GPIO_CHIP_PATH "/dev/bone_gpiochip"
+
+// Lines are numbered in the order of the bone_gpio_devs children in the DT,
+// leaving out the bus nodes; only the first BONE_GPIO_MAX_LINES are reachable through the chip device
+#define BONE_GPIO_MAX_LINES 64
+
+#define BONE_GPIO_IOC_MAGIC 'B'
+
+// Bit n of mask selects line n; bits holds the logical values of the selected lines
+struct bone_gpio_values {
+  __u64 mask;
+  __u64 bits;
+};
+
+// Number of lines
+#define BONE_GPIO_IOC_GET_NLINES _IOR(BONE_GPIO_IOC_MAGIC, 0, __u32)
+
+// Reads all selected lines in one go, lines on the same controller from a single
+// register read
+#define BONE_GPIO_IOC_GET_VALUES _IOWR(BONE_GPIO_IOC_MAGIC, 1, struct bone_gpio_values)
+
+// Drives all selected lines in one go, lines on the same controller change with a
+// single register write. The lines must already be outputs.
+#define BONE_GPIO_IOC_SET_VALUES _IOW(BONE_GPIO_IOC_MAGIC, 2, struct bone_gpio_values)
+
+// One waveform step: drive the lines in mask to bits, then hold for delay_ns before
+// the next step. Lines outside mask keep their value.
+struct bone_gpio_seq_step {
+  __u64 mask;
+  __u64 bits;
+  __u64 delay_ns;
+};
+
+struct bone_gpio_seq {
+  __u64 steps; // User pointer to nr_steps struct bone_gpio_seq_step
+  __u32 nr_steps;
+  __u32 flags;
+};
+
+#define BONE_GPIO_SEQ_MAX_STEPS 65536
+
+// Don't return before the sequence has finished
+#define BONE_GPIO_SEQ_WAIT (1 << 0)
+
+// Plays a sequence back from an hrtimer in the kernel. Returns once it is queued,
+// or with BONE_GPIO_SEQ_WAIT once it has finished (0, or the error that stopped
+// it). poll() reports the chip fd writable while no sequence runs on it. One
+// sequence per open file at a time; the lines must be outputs on a controller
+// that can be driven without sleeping.
+#define BONE_GPIO_IOC_SEQ_START _IOW(BONE_GPIO_IOC_MAGIC, 3, struct bone_gpio_seq)
+
+// Aborts the sequence of this file, the lines stay where it left them
+#define BONE_GPIO_IOC_SEQ_STOP _IO(BONE_GPIO_IOC_MAGIC, 4)
+
+#define BONE_GPIO_EVENT_RISING 1
+#define BONE_GPIO_EVENT_FALLING 2
+#define BONE_GPIO_EVENT_MEASUREMENT 3 // A counter window ended, see BONE_GPIO_IOC_GET_MEASUREMENT
+
+// What read() on the chip device returns, oldest first across the watched lines.
+// Which edges a line reports is set through its edge attribute.
+struct bone_gpio_event {
+  __u64 timestamp_ns; // CLOCK_MONOTONIC, taken in the irq handler
+  __u32 line;
+  __u32 id; // BONE_GPIO_EVENT_*
+  __u32 seqno; // Per line, a gap means the line's FIFO overflowed
+  __u32 padding;
+};
+
+// Selects the lines read() and poll() report edge events of, bit n for line n
+#define BONE_GPIO_IOC_WATCH _IOW(BONE_GPIO_IOC_MAGIC, 5, __u64)
+
+// Logic analyzer capture. The selected lines are sampled together every period_ns
+// into a ring that is mapped with mmap(fd, mmap_size, ..., 0). It starts with a
+// struct bone_gpio_ring; the samples follow at data_offset, one __u64 each with
+// bit n for line n. Samples [tail, head) are valid at index & (nr_samples - 1).
+struct bone_gpio_capture {
+  __u64 mask;
+  __u64 period_ns;
+  __u32 nr_samples; // Power of 2, at most BONE_GPIO_CAPTURE_MAX_SAMPLES
+  __u32 flags; // Must be 0
+  __u64 mmap_size; // Set by the driver
+};
+
+#define BONE_GPIO_CAPTURE_MIN_PERIOD_NS 10000
+#define BONE_GPIO_CAPTURE_MAX_SAMPLES (1 << 24)
+
+struct bone_gpio_ring {
+  __u32 head; // Free running, only the driver moves it
+  __u32 tail; // Free running, only the reader moves it
+  __u32 nr_samples;
+  __u32 overruns; // Samples dropped because the ring was full
+  __u32 missed; // Sample periods the timer fired too late for
+  __u32 data_offset;
+  __u64 mask;
+  __u64 period_ns;
+};
+
+// Starts sampling into a fresh ring, or into the current one (reset) if it is
+// still mapped, which then needs the same nr_samples
+#define BONE_GPIO_IOC_CAPTURE_START _IOWR(BONE_GPIO_IOC_MAGIC, 6, struct bone_gpio_capture)
+
+// Stops sampling, the ring stays mapped and readable
+#define BONE_GPIO_IOC_CAPTURE_STOP _IO(BONE_GPIO_IOC_MAGIC, 7)
+
+// Result of a counter mode window, set through the line's counter_window_ms attribute
+struct bone_gpio_measurement {
+  __u64 timestamp_ns; // End of the window, CLOCK_MONOTONIC
+  __u64 window_ns;
+  __u64 frequency_millihz; // Rising edges per second, in thousandths
+  __u64 high_ns; // Mean width of the high pulses that ended in the window, 0 if none
+  __u64 low_ns; // Same for low pulses
+  __u32 edges; // Both directions
+  __u32 line; // Set by the caller
+};
+
+// Latest measurement of a line in counter mode
+#define BONE_GPIO_IOC_GET_MEASUREMENT _IOWR(BONE_GPIO_IOC_MAGIC, 8, struct bone_gpio_measurement)
+
+// Parallel bus declared as a bone_gpio_devs child with data-gpios and strobe-gpios.
+// Each byte written to its device is clocked out by the driver: set the data
+// lines, wait setup-ns, pulse the strobe for strobe-ns, wait hold-ns. A 4 bit bus
+// takes two cycles per byte, high nibble first.
+#define BONE_GPIO_BUS_PATH_FMT "/dev/bone_bus_%s"
+
+// Level of the bus's select line (e.g. an LCD's RS) for the following cycles
+#define BONE_GPIO_BUS_IOC_SET_SELECT _IOW(BONE_GPIO_IOC_MAGIC, 9, __u32)
+
+// A single cycle with the low bits of the argument, e.g. the lone nibbles of an
+// HD44780 initialisation on a 4 bit bus
+#define BONE_GPIO_BUS_IOC_CYCLE _IOW(BONE_GPIO_IOC_MAGIC, 10, __u32)
+
+#endif // BONE_GPIO_IOCTL_H
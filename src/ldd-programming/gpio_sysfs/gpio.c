@@ -8,7 +8,9 @@
 #include <unistd.h>
 #include<string.h>
 #include<stdlib.h>
+#include <sys/ioctl.h>
 #include "gpio.h"
+#include "bone_gpio_ioctl.h"
 
 /*
  *  GPIO configure direction
@@ -40,6 +42,106 @@ int gpio_configure_dir(char *gpio_label, uint8_t dir_value)
   return 0;
 }
 
+/*
+ *  GPIO configure edge events
+ *  edge : "none", "rising", "falling" or "both"
+ *  After this, poll() on the line's value file reports POLLPRI on every edge.
+ */
+int gpio_configure_edge(char *gpio_label, char *edge)
+{
+  int fd;
+  char buf[SOME_BYTES];
+
+  snprintf(buf, sizeof(buf), SYS_GPIO_PATH "/%s/edge", gpio_label);
+
+  fd = open(buf, O_WRONLY | O_SYNC);
+  if (fd < 0) {
+    perror("gpio edge configure\n");
+    return fd;
+  }
+
+  if (write(fd, edge, strlen(edge) + 1) < 0) {
+    perror("gpio edge configure\n");
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  return 0;
+}
+
+/*
+ *  GPIO configure debounce
+ *  debounce_us : how long a new value has to hold before it is seen, 0 turns it off
+ */
+int gpio_configure_debounce(char *gpio_label, unsigned int debounce_us)
+{
+  int fd;
+  char buf[SOME_BYTES];
+
+  snprintf(buf, sizeof(buf), SYS_GPIO_PATH "/%s/debounce_us", gpio_label);
+
+  fd = open(buf, O_WRONLY | O_SYNC);
+  if (fd < 0) {
+    perror("gpio debounce configure\n");
+    return fd;
+  }
+
+  snprintf(buf, sizeof(buf), "%u", debounce_us);
+  if (write(fd, buf, strlen(buf) + 1) < 0) {
+    perror("gpio debounce configure\n");
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  return 0;
+}
+
+// Writes a number to one of a line's sysfs attributes
+static int gpio_write_attr(char *gpio_label, char *attr, unsigned long long value)
+{
+  int fd;
+  char buf[SOME_BYTES];
+
+  snprintf(buf, sizeof(buf), SYS_GPIO_PATH "/%s/%s", gpio_label, attr);
+
+  fd = open(buf, O_WRONLY | O_SYNC);
+  if (fd < 0) {
+    perror("gpio attribute write\n");
+    return fd;
+  }
+
+  snprintf(buf, sizeof(buf), "%llu", value);
+  if (write(fd, buf, strlen(buf) + 1) < 0) {
+    perror("gpio attribute write\n");
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  return 0;
+}
+
+/*
+ *  GPIO software PWM
+ *  period_ns : 0 stops the PWM, the line keeps its last value
+ *  duty_ns   : active time per period, at most period_ns
+ */
+int gpio_configure_pwm(char *gpio_label, uint64_t period_ns, uint64_t duty_ns)
+{
+  // Duty first when stopping or shrinking it, so it never exceeds the period
+  if (gpio_write_attr(gpio_label, "duty_ns", 0) < 0 ||
+      gpio_write_attr(gpio_label, "period_ns", period_ns) < 0) {
+    return -1;
+  }
+
+  return period_ns ? gpio_write_attr(gpio_label, "duty_ns", duty_ns) : 0;
+}
+
 /*
  *  GPIO write value
  *  out_value : can be either 0 or 1
@@ -115,3 +217,144 @@ int gpio_file_close(int fd)
 {
   return close(fd);
 }
+
+// Opens the chip device used by the mask functions below
+int gpio_chip_open(void)
+{
+  int fd;
+
+  fd = open(BONE_GPIO_CHIP_PATH, O_RDWR);
+  if (fd < 0) {
+    perror("gpio chip open\n");
+  }
+
+  return fd;
+}
+
+/*
+ *  GPIO write several lines at once
+ *  mask   : bit n selects line n (DT order under bone_gpio_devs)
+ *  values : new values of the selected lines
+ */
+int gpio_write_mask(int chip_fd, uint64_t mask, uint64_t values)
+{
+  struct bone_gpio_values vals = { .mask = mask, .bits = values };
+
+  if (ioctl(chip_fd, BONE_GPIO_IOC_SET_VALUES, &vals) < 0) {
+    perror("gpio write mask\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+// GPIO read several lines at once, unselected bits of *values come back as 0
+int gpio_read_mask(int chip_fd, uint64_t mask, uint64_t *values)
+{
+  struct bone_gpio_values vals = { .mask = mask };
+
+  if (ioctl(chip_fd, BONE_GPIO_IOC_GET_VALUES, &vals) < 0) {
+    perror("gpio read mask\n");
+    return -1;
+  }
+
+  *values = vals.bits;
+
+  return 0;
+}
+
+/*
+ *  GPIO play a waveform
+ *  steps    : each step drives its mask to its bits, then holds for delay_ns
+ *  nr_steps : at most BONE_GPIO_SEQ_MAX_STEPS
+ *  The edges are timed by an hrtimer in the driver, this only returns once the
+ *  last step's delay has passed.
+ */
+int gpio_play_sequence(int chip_fd, const struct bone_gpio_seq_step *steps, uint32_t nr_steps)
+{
+  struct bone_gpio_seq seq = {
+    .steps = (uintptr_t)steps,
+    .nr_steps = nr_steps,
+    .flags = BONE_GPIO_SEQ_WAIT,
+  };
+
+  if (ioctl(chip_fd, BONE_GPIO_IOC_SEQ_START, &seq) < 0) {
+    perror("gpio play sequence\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Selects the lines whose edge events read() on the chip device returns
+int gpio_chip_watch(int chip_fd, uint64_t mask)
+{
+  if (ioctl(chip_fd, BONE_GPIO_IOC_WATCH, &mask) < 0) {
+    perror("gpio chip watch\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ *  GPIO counter mode
+ *  window_ms : measurement window, 0 stops counting
+ *  Each window ends with a BONE_GPIO_EVENT_MEASUREMENT event for the line on the
+ *  chip device, gpio_read_measurement then returns the result.
+ */
+int gpio_configure_counter(char *gpio_label, unsigned int window_ms)
+{
+  return gpio_write_attr(gpio_label, "counter_window_ms", window_ms);
+}
+
+int gpio_read_measurement(int chip_fd, uint32_t line, struct bone_gpio_measurement *result)
+{
+  result->line = line;
+
+  if (ioctl(chip_fd, BONE_GPIO_IOC_GET_MEASUREMENT, result) < 0) {
+    perror("gpio read measurement\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+// Returns -1 without a message when the DT has no such bus, callers fall back to
+// the single lines
+int gpio_bus_open(const char *label)
+{
+  char buf[SOME_BYTES];
+  int fd;
+
+  snprintf(buf, sizeof(buf), BONE_GPIO_BUS_PATH_FMT, label);
+
+  fd = open(buf, O_WRONLY);
+  if (fd < 0 && errno != ENOENT) {
+    perror("gpio bus open\n");
+  }
+
+  return fd;
+}
+
+// Level of the bus's select line for the following writes
+int gpio_bus_select(int bus_fd, uint32_t value)
+{
+  if (ioctl(bus_fd, BONE_GPIO_BUS_IOC_SET_SELECT, &value) < 0) {
+    perror("gpio bus select\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+// A single bus cycle with the low bits of bits
+int gpio_bus_cycle(int bus_fd, uint32_t bits)
+{
+  if (ioctl(bus_fd, BONE_GPIO_BUS_IOC_CYCLE, &bits) < 0) {
+    perror("gpio bus cycle\n");
+    return -1;
+  }
+
+  return 0;
+}
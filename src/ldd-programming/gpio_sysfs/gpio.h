@@ -20,5 +20,31 @@ int gpio_write_value(char *label, uint8_t out_value);
 int gpio_read_value(char *label);
 int gpio_file_open(char *label);
 int gpio_file_close(int fd);
+int gpio_configure_edge(char *label, char *edge);
+int gpio_configure_debounce(char *label, unsigned int debounce_us);
+int gpio_configure_pwm(char *label, uint64_t period_ns, uint64_t duty_ns);
+
+// Multi-line access through the chip device, bit n of mask/values is line n
+int gpio_chip_open(void);
+int gpio_write_mask(int chip_fd, uint64_t mask, uint64_t values);
+int gpio_read_mask(int chip_fd, uint64_t mask, uint64_t *values);
+
+// Plays a waveform through the chip device's in-kernel sequencer and waits for it
+struct bone_gpio_seq_step;
+int gpio_play_sequence(int chip_fd, const struct bone_gpio_seq_step *steps, uint32_t nr_steps);
+
+// Edge events of the lines in mask become readable as struct bone_gpio_event
+int gpio_chip_watch(int chip_fd, uint64_t mask);
+
+// Counter mode: frequency and pulse widths measured in the driver
+struct bone_gpio_measurement;
+int gpio_configure_counter(char *label, unsigned int window_ms);
+int gpio_read_measurement(int chip_fd, uint32_t line, struct bone_gpio_measurement *result);
+
+// Parallel bus device of a bone_gpio_devs bus node, bytes written to it are
+// clocked out in the driver
+int gpio_bus_open(const char *label);
+int gpio_bus_select(int bus_fd, uint32_t value);
+int gpio_bus_cycle(int bus_fd, uint32_t bits);
 
 #endif // GPIO_DRIVER_H
@@ -0,0 +1,377 @@
+#include <linux/bitmap.h>
+#include <linux/delay.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/sched/signal.h>
+#include "gpio_sysfs.h"
+
+// Parallel buses. A bone_gpio_devs child with data-gpios is a bus rather than a
+// line:
+//   label         name of the bus, the device is /dev/bone_bus_<label>
+//   data-gpios    4 or 8 data lines, least significant bit first
+//   strobe-gpios  pulsed active once the data lines are set, e.g. an LCD's EN
+//   select-gpios  optional, set through BONE_GPIO_BUS_IOC_SET_SELECT, e.g. RS
+//   setup-ns      data valid before the strobe goes active (default 1000)
+//   strobe-ns     width of the strobe pulse (default 1000)
+//   hold-ns       after the strobe goes inactive, before the next cycle (default 1000)
+// Every byte written to the device is clocked out in the kernel, as one cycle on
+// an 8 bit bus or two on a 4 bit bus (high nibble first). The writer sleeps
+// through delays of 10 us or more and spins through the shorter ones.
+
+#define GPIO_BUS_MAX 8
+#define GPIO_BUS_MAX_WIDTH 8
+
+struct gpio_bus {
+  struct list_head node; // On gpio_buses
+  struct kref ref; // The list and every open file
+  char label[20];
+  unsigned int width;
+  struct gpio_desc* data[GPIO_BUS_MAX_WIDTH];
+  struct gpio_desc* strobe;
+  struct gpio_desc* select; // NULL if the bus has none
+  u32 setup_ns;
+  u32 strobe_ns;
+  u32 hold_ns;
+  struct mutex lock; // One transfer at a time, and gone
+  bool gone; // The lines were released on remove
+  unsigned int minor;
+  struct cdev* cdev; // Allocated, it can outlive the bus while a file is open
+  struct device* dev;
+};
+
+static dev_t gpio_bus_devt;
+static LIST_HEAD(gpio_buses); // Under gpio_drv_data.lock
+static DECLARE_BITMAP(gpio_bus_minors, GPIO_BUS_MAX);
+
+static void gpio_bus_free(struct kref* ref)
+{
+  kfree(container_of(ref, struct gpio_bus, ref));
+}
+
+static void gpio_bus_delay(u32 ns)
+{
+  if (ns >= 10 * NSEC_PER_USEC) {
+    fsleep(DIV_ROUND_UP(ns, NSEC_PER_USEC));
+  } else if (ns) {
+    ndelay(ns);
+  }
+}
+
+// Drives the low width bits onto the data lines and strobes them, with bus->lock held
+static int gpio_bus_cycle(struct gpio_bus* bus, unsigned int bits)
+{
+  DECLARE_BITMAP(vals, GPIO_BUS_MAX_WIDTH);
+  int ret;
+
+  bitmap_zero(vals, GPIO_BUS_MAX_WIDTH);
+  vals[0] = bits & GENMASK(bus->width - 1, 0);
+
+  ret = gpiod_set_array_value_cansleep(bus->width, bus->data, NULL, vals);
+  if (ret) {
+    return ret;
+  }
+
+  gpio_bus_delay(bus->setup_ns);
+  gpiod_set_value_cansleep(bus->strobe, 1);
+  gpio_bus_delay(bus->strobe_ns);
+  gpiod_set_value_cansleep(bus->strobe, 0);
+  gpio_bus_delay(bus->hold_ns);
+
+  return 0;
+}
+
+static int gpio_bus_write_byte(struct gpio_bus* bus, u8 byte)
+{
+  int ret;
+
+  if (bus->width == 8) {
+    return gpio_bus_cycle(bus, byte);
+  }
+
+  ret = gpio_bus_cycle(bus, byte >> 4);
+  if (ret) {
+    return ret;
+  }
+
+  return gpio_bus_cycle(bus, byte & 0xf);
+}
+
+static int gpio_bus_open(struct inode* inode, struct file* filp)
+{
+  struct gpio_bus* bus;
+  int ret = -ENODEV;
+
+  // Looked up under the list lock, so remove can't drop the last reference meanwhile
+  mutex_lock(&gpio_drv_data.lock);
+  list_for_each_entry(bus, &gpio_buses, node) {
+    if (bus->minor == iminor(inode)) {
+      kref_get(&bus->ref);
+      filp->private_data = bus;
+      ret = 0;
+      break;
+    }
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (ret) {
+    return ret;
+  }
+
+  return nonseekable_open(inode, filp);
+}
+
+static int gpio_bus_release(struct inode* inode, struct file* filp)
+{
+  struct gpio_bus* bus = filp->private_data;
+
+  kref_put(&bus->ref, gpio_bus_free);
+
+  return 0;
+}
+
+// Returns short after a signal, with the bytes clocked out so far
+static ssize_t gpio_bus_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
+{
+  struct gpio_bus* bus = filp->private_data;
+  u8 chunk[64];
+  size_t done = 0;
+  size_t len;
+  size_t i;
+  int ret = 0;
+
+  if (mutex_lock_interruptible(&bus->lock)) {
+    return -ERESTARTSYS;
+  }
+
+  if (bus->gone) {
+    ret = -ENODEV;
+    goto unlock;
+  }
+
+  while (done < count) {
+    if (signal_pending(current)) {
+      ret = -ERESTARTSYS;
+      break;
+    }
+
+    len = min(count - done, sizeof(chunk));
+    if (copy_from_user(chunk, buff + done, len)) {
+      ret = -EFAULT;
+      break;
+    }
+
+    for (i = 0; i < len && !ret; i++) {
+      ret = gpio_bus_write_byte(bus, chunk[i]);
+    }
+    done += ret ? i - 1 : i;
+
+    if (ret) {
+      break;
+    }
+  }
+
+unlock:
+  mutex_unlock(&bus->lock);
+
+  return done ? done : ret;
+}
+
+static long gpio_bus_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+  struct gpio_bus* bus = filp->private_data;
+  u32 value;
+  int ret = 0;
+
+  if (cmd != BONE_GPIO_BUS_IOC_SET_SELECT && cmd != BONE_GPIO_BUS_IOC_CYCLE) {
+    return -ENOTTY;
+  }
+
+  if (get_user(value, (u32 __user*)arg)) {
+    return -EFAULT;
+  }
+
+  if (mutex_lock_interruptible(&bus->lock)) {
+    return -ERESTARTSYS;
+  }
+
+  if (bus->gone) {
+    ret = -ENODEV;
+  } else if (cmd == BONE_GPIO_BUS_IOC_CYCLE) {
+    ret = gpio_bus_cycle(bus, value);
+  } else if (!bus->select) {
+    ret = -EOPNOTSUPP;
+  } else {
+    // Settles during the setup time of the next cycle
+    gpiod_set_value_cansleep(bus->select, !!value);
+  }
+
+  mutex_unlock(&bus->lock);
+
+  return ret;
+}
+
+static const struct file_operations gpio_bus_fops = {
+  .owner = THIS_MODULE,
+  .open = gpio_bus_open,
+  .release = gpio_bus_release,
+  .write = gpio_bus_write,
+  .llseek = no_llseek,
+  .unlocked_ioctl = gpio_bus_ioctl,
+  .compat_ioctl = compat_ptr_ioctl,
+};
+
+static int gpio_bus_get_lines(struct device* dev, struct fwnode_handle* child, struct gpio_bus* bus)
+{
+  struct gpio_desc* desc;
+  unsigned int i;
+
+  for (i = 0; i <= GPIO_BUS_MAX_WIDTH; i++) {
+    desc = devm_fwnode_gpiod_get_index(dev, child, "data", i, GPIOD_OUT_LOW, bus->label);
+    if (PTR_ERR(desc) == -ENOENT) {
+      break;
+    }
+    if (IS_ERR(desc)) {
+      return PTR_ERR(desc);
+    }
+    if (i == GPIO_BUS_MAX_WIDTH) {
+      dev_err(dev, "Bus %s has more than %d data-gpios\n", bus->label, GPIO_BUS_MAX_WIDTH);
+      return -EINVAL;
+    }
+    bus->data[i] = desc;
+  }
+
+  if (i != 4 && i != 8) {
+    dev_err(dev, "Bus %s needs 4 or 8 data-gpios\n", bus->label);
+    return -EINVAL;
+  }
+  bus->width = i;
+
+  bus->strobe = devm_fwnode_gpiod_get(dev, child, "strobe", GPIOD_OUT_LOW, bus->label);
+  if (IS_ERR(bus->strobe)) {
+    dev_err(dev, "Bus %s has no strobe-gpios\n", bus->label);
+    return PTR_ERR(bus->strobe);
+  }
+
+  bus->select = devm_fwnode_gpiod_get(dev, child, "select", GPIOD_OUT_LOW, bus->label);
+  if (PTR_ERR(bus->select) == -ENOENT) {
+    bus->select = NULL;
+  } else if (IS_ERR(bus->select)) {
+    return PTR_ERR(bus->select);
+  }
+
+  return 0;
+}
+
+// Sets up the bus described by child, called from probe
+int gpio_bus_create(struct device* dev, struct fwnode_handle* child)
+{
+  struct gpio_bus* bus;
+  const char* name;
+  int minor;
+  int ret;
+
+  minor = find_first_zero_bit(gpio_bus_minors, GPIO_BUS_MAX);
+  if (minor == GPIO_BUS_MAX) {
+    dev_err(dev, "More than %d buses\n", GPIO_BUS_MAX);
+    return -ENOSPC;
+  }
+
+  bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+  if (!bus) {
+    return -ENOMEM;
+  }
+
+  kref_init(&bus->ref);
+  mutex_init(&bus->lock);
+  bus->minor = minor;
+
+  if (fwnode_property_read_string(child, "label", &name)) {
+    name = fwnode_get_name(child);
+  }
+  strscpy(bus->label, name, sizeof(bus->label));
+
+  bus->setup_ns = 1000;
+  bus->strobe_ns = 1000;
+  bus->hold_ns = 1000;
+  fwnode_property_read_u32(child, "setup-ns", &bus->setup_ns);
+  fwnode_property_read_u32(child, "strobe-ns", &bus->strobe_ns);
+  fwnode_property_read_u32(child, "hold-ns", &bus->hold_ns);
+
+  ret = gpio_bus_get_lines(dev, child, bus);
+  if (ret) {
+    goto free_bus;
+  }
+
+  bus->cdev = cdev_alloc();
+  if (!bus->cdev) {
+    ret = -ENOMEM;
+    goto free_bus;
+  }
+  bus->cdev->ops = &gpio_bus_fops;
+  bus->cdev->owner = THIS_MODULE;
+
+  ret = cdev_add(bus->cdev, MKDEV(MAJOR(gpio_bus_devt), minor), 1);
+  if (ret) {
+    goto del_cdev;
+  }
+
+  bus->dev = device_create(gpio_drv_data.class_gpio, dev, bus->cdev->dev, bus, "bone_bus_%s", bus->label);
+  if (IS_ERR(bus->dev)) {
+    ret = PTR_ERR(bus->dev);
+    goto del_cdev;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+  __set_bit(minor, gpio_bus_minors);
+  list_add_tail(&bus->node, &gpio_buses);
+  mutex_unlock(&gpio_drv_data.lock);
+
+  dev_info(dev, "Bus %s: %u data lines, setup %u ns, strobe %u ns, hold %u ns\n",
+           bus->label, bus->width, bus->setup_ns, bus->strobe_ns, bus->hold_ns);
+
+  return 0;
+
+del_cdev:
+  // Also drops the reference of cdev_alloc()
+  cdev_del(bus->cdev);
+free_bus:
+  kfree(bus);
+  return ret;
+}
+
+// The descriptors are devm managed and go away after remove, open files get
+// -ENODEV from then on
+void gpio_bus_destroy_all(void)
+{
+  struct gpio_bus* bus;
+  struct gpio_bus* tmp;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  list_for_each_entry_safe(bus, tmp, &gpio_buses, node) {
+    list_del(&bus->node);
+
+    device_destroy(gpio_drv_data.class_gpio, bus->cdev->dev);
+    cdev_del(bus->cdev);
+    __clear_bit(bus->minor, gpio_bus_minors);
+
+    // Waits for a transfer in progress
+    mutex_lock(&bus->lock);
+    bus->gone = true;
+    mutex_unlock(&bus->lock);
+
+    kref_put(&bus->ref, gpio_bus_free);
+  }
+
+  mutex_unlock(&gpio_drv_data.lock);
+}
+
+int gpio_bus_init(void)
+{
+  return alloc_chrdev_region(&gpio_bus_devt, 0, GPIO_BUS_MAX, "bone_gpiobus");
+}
+
+void gpio_bus_exit(void)
+{
+  unregister_chrdev_region(gpio_bus_devt, GPIO_BUS_MAX);
+}
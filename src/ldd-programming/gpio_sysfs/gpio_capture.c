@@ -0,0 +1,266 @@
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include "gpio_sysfs.h"
+
+// Logic analyzer mode. An hrtimer samples all the captured lines with a single
+// gpiod_get_array_value() per period into a vmalloc'ed ring that user space maps.
+// The ring is a single producer/single consumer queue over free running head and
+// tail counters in its header, so reading it takes no syscalls at all. The header
+// is writable by the reader, so the timer keeps its own head, size and counters
+// and only ever reads tail back from it.
+
+struct gpio_capture {
+  struct list_head node; // On gpio_captures
+  struct hrtimer timer;
+  ktime_t period;
+  struct bone_gpio_ring* ring;
+  size_t size;
+  u64* samples;
+  u32 head; // Published to ring->head
+  u32 nr_samples;
+  u32 overruns; // Published to ring->overruns
+  u32 missed; // Published to ring->missed
+  atomic_t mapped; // VMAs of the ring, which must not be freed while there are any
+  struct gpio_desc* descs[BONE_GPIO_MAX_LINES];
+  unsigned int ids[BONE_GPIO_MAX_LINES];
+  unsigned int nr_descs;
+  bool running;
+};
+
+// Captures of all open chip files, protected by gpio_drv_data.lock like the
+// captures themselves
+static LIST_HEAD(gpio_captures);
+
+static enum hrtimer_restart gpio_capture_timer(struct hrtimer* timer)
+{
+  struct gpio_capture* cap = container_of(timer, struct gpio_capture, timer);
+  struct bone_gpio_ring* ring = cap->ring;
+  DECLARE_BITMAP(vals, BONE_GPIO_MAX_LINES);
+  u64 sample = 0;
+  u64 overrun;
+  unsigned int i;
+
+  overrun = hrtimer_forward_now(timer, cap->period);
+  if (overrun > 1) {
+    cap->missed += overrun - 1;
+    WRITE_ONCE(ring->missed, cap->missed);
+  }
+
+  if (gpiod_get_array_value(cap->nr_descs, cap->descs, NULL, vals)) {
+    cap->missed++;
+    WRITE_ONCE(ring->missed, cap->missed);
+    return HRTIMER_RESTART;
+  }
+
+  for (i = 0; i < cap->nr_descs; i++) {
+    if (test_bit(i, vals)) {
+      sample |= BIT_ULL(cap->ids[i]);
+    }
+  }
+
+  // Pairs with the reader's release of tail, it's done with the slots before them.
+  // A tail that isn't within nr_samples behind head is bogus, and the ring full.
+  if (cap->head - smp_load_acquire(&ring->tail) >= cap->nr_samples) {
+    cap->overruns++;
+    WRITE_ONCE(ring->overruns, cap->overruns);
+    return HRTIMER_RESTART;
+  }
+
+  cap->samples[cap->head & (cap->nr_samples - 1)] = sample;
+  cap->head++;
+  smp_store_release(&ring->head, cap->head);
+
+  return HRTIMER_RESTART;
+}
+
+struct gpio_capture* gpio_capture_alloc(void)
+{
+  struct gpio_capture* cap;
+
+  cap = kzalloc(sizeof(*cap), GFP_KERNEL);
+  if (!cap) {
+    return NULL;
+  }
+
+  hrtimer_init(&cap->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  cap->timer.function = gpio_capture_timer;
+
+  mutex_lock(&gpio_drv_data.lock);
+  list_add(&cap->node, &gpio_captures);
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return cap;
+}
+
+// The file is gone, and with it every mapping of the ring
+void gpio_capture_free(struct gpio_capture* cap)
+{
+  mutex_lock(&gpio_drv_data.lock);
+  gpio_capture_stop(cap);
+  list_del(&cap->node);
+  mutex_unlock(&gpio_drv_data.lock);
+
+  vfree(cap->ring);
+  kfree(cap);
+}
+
+// With gpio_drv_data.lock held
+void gpio_capture_stop(struct gpio_capture* cap)
+{
+  hrtimer_cancel(&cap->timer);
+  cap->running = false;
+}
+
+// With gpio_drv_data.lock held, before the lines are destroyed
+void gpio_capture_stop_all(void)
+{
+  struct gpio_capture* cap;
+
+  list_for_each_entry(cap, &gpio_captures, node) {
+    gpio_capture_stop(cap);
+  }
+}
+
+long gpio_capture_start(struct gpio_capture* cap, struct bone_gpio_capture __user* uarg)
+{
+  struct bone_gpio_capture arg;
+  struct gpio_chip_lines lines;
+  struct bone_gpio_ring* ring;
+  size_t data_offset;
+  size_t size;
+  unsigned int i;
+  long ret;
+
+  if (copy_from_user(&arg, uarg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
+  if (arg.flags || !arg.mask || arg.period_ns < BONE_GPIO_CAPTURE_MIN_PERIOD_NS ||
+      !is_power_of_2(arg.nr_samples) || arg.nr_samples > BONE_GPIO_CAPTURE_MAX_SAMPLES) {
+    return -EINVAL;
+  }
+
+  data_offset = PAGE_ALIGN(sizeof(*ring));
+  size = PAGE_ALIGN(data_offset + (size_t)arg.nr_samples * sizeof(*cap->samples));
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  if (cap->running) {
+    ret = -EBUSY;
+    goto unlock;
+  }
+
+  ret = gpio_chip_collect(arg.mask, &lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  // Sampled from the timer callback, in interrupt context
+  for (i = 0; i < lines.nr; i++) {
+    if (gpiod_cansleep(lines.descs[i])) {
+      ret = -EOPNOTSUPP;
+      goto unlock;
+    }
+  }
+
+  if (cap->ring && cap->size != size) {
+    if (atomic_read(&cap->mapped)) {
+      ret = -EBUSY;
+      goto unlock;
+    }
+    vfree(cap->ring);
+    cap->ring = NULL;
+  }
+
+  if (!cap->ring) {
+    cap->ring = vmalloc_user(size);
+    if (!cap->ring) {
+      ret = -ENOMEM;
+      goto unlock;
+    }
+    cap->size = size;
+  }
+
+  ring = cap->ring;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->nr_samples = arg.nr_samples;
+  ring->overruns = 0;
+  ring->missed = 0;
+  ring->data_offset = data_offset;
+  ring->mask = arg.mask;
+  ring->period_ns = arg.period_ns;
+  cap->samples = (void*)ring + data_offset;
+  cap->head = 0;
+  cap->nr_samples = arg.nr_samples;
+  cap->overruns = 0;
+  cap->missed = 0;
+
+  memcpy(cap->descs, lines.descs, sizeof(lines.descs));
+  memcpy(cap->ids, lines.ids, sizeof(lines.ids));
+  cap->nr_descs = lines.nr;
+  cap->period = ns_to_ktime(arg.period_ns);
+  cap->running = true;
+
+  hrtimer_start(&cap->timer, cap->period, HRTIMER_MODE_REL);
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (ret) {
+    return ret;
+  }
+
+  arg.mmap_size = size;
+
+  return copy_to_user(uarg, &arg, sizeof(arg)) ? -EFAULT : 0;
+}
+
+static void gpio_capture_vm_open(struct vm_area_struct* vma)
+{
+  struct gpio_capture* cap = vma->vm_private_data;
+
+  atomic_inc(&cap->mapped);
+}
+
+static void gpio_capture_vm_close(struct vm_area_struct* vma)
+{
+  struct gpio_capture* cap = vma->vm_private_data;
+
+  atomic_dec(&cap->mapped);
+}
+
+static const struct vm_operations_struct gpio_capture_vm_ops = {
+  .open = gpio_capture_vm_open,
+  .close = gpio_capture_vm_close,
+};
+
+int gpio_capture_mmap(struct gpio_capture* cap, struct vm_area_struct* vma)
+{
+  int ret;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  if (!cap->ring) {
+    ret = -EINVAL;
+    goto unlock;
+  }
+
+  ret = remap_vmalloc_range(vma, cap->ring, vma->vm_pgoff);
+  if (ret) {
+    goto unlock;
+  }
+
+  vma->vm_ops = &gpio_capture_vm_ops;
+  vma->vm_private_data = cap;
+  atomic_inc(&cap->mapped);
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return ret;
+}
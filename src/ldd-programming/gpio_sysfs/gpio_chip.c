@@ -0,0 +1,286 @@
+#include <linux/bitmap.h>
+#include "gpio_sysfs.h"
+#include "bone_gpio_ioctl.h"
+
+// Chip level character device. Setting or reading several lines goes through
+// gpiod_{set,get}_array_value, which hands each controller all of its lines at
+// once, instead of one sysfs access per line.
+
+// Gathers the descriptors of the lines in mask, with gpio_drv_data.lock held
+int gpio_chip_collect(u64 mask, struct gpio_chip_lines* lines)
+{
+  struct gpiodev_private_data* dev_data;
+  unsigned int i;
+
+  if (gpio_drv_data.total_devices < BONE_GPIO_MAX_LINES && (mask >> gpio_drv_data.total_devices)) {
+    return -EINVAL;
+  }
+
+  lines->nr = 0;
+  for (i = 0; i < min(gpio_drv_data.total_devices, BONE_GPIO_MAX_LINES); i++) {
+    if (!(mask & BIT_ULL(i))) {
+      continue;
+    }
+    dev_data = gpio_drv_data.lines[i];
+    lines->descs[lines->nr] = dev_data->desc;
+    lines->ids[lines->nr] = i;
+    lines->nr++;
+  }
+
+  return 0;
+}
+
+// Lines driven as PWM outputs belong to their timer, with gpio_drv_data.lock held
+int gpio_chip_check_pwm(const struct gpio_chip_lines* lines)
+{
+  unsigned int i;
+
+  for (i = 0; i < lines->nr; i++) {
+    if (READ_ONCE(gpio_drv_data.lines[lines->ids[i]]->pwm_period_ns)) {
+      return -EBUSY;
+    }
+  }
+
+  return 0;
+}
+
+static long gpio_chip_get_values(struct bone_gpio_values __user* uarg)
+{
+  DECLARE_BITMAP(vals, BONE_GPIO_MAX_LINES);
+  struct gpio_chip_lines lines;
+  struct bone_gpio_values arg;
+  unsigned int i;
+  int ret;
+
+  if (copy_from_user(&arg, uarg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+  ret = gpio_chip_collect(arg.mask, &lines);
+  if (!ret && lines.nr) {
+    ret = gpiod_get_array_value_cansleep(lines.nr, lines.descs, NULL, vals);
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (ret) {
+    return ret;
+  }
+
+  arg.bits = 0;
+  for (i = 0; i < lines.nr; i++) {
+    if (test_bit(i, vals)) {
+      arg.bits |= BIT_ULL(lines.ids[i]);
+    }
+  }
+
+  return copy_to_user(uarg, &arg, sizeof(arg)) ? -EFAULT : 0;
+}
+
+static long gpio_chip_set_values(struct bone_gpio_values __user* uarg)
+{
+  DECLARE_BITMAP(vals, BONE_GPIO_MAX_LINES);
+  struct gpio_chip_lines lines;
+  struct bone_gpio_values arg;
+  unsigned int i;
+  int ret;
+
+  if (copy_from_user(&arg, uarg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  ret = gpio_chip_collect(arg.mask, &lines);
+  if (ret || !lines.nr) {
+    goto unlock;
+  }
+
+  ret = gpio_chip_check_pwm(&lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  bitmap_zero(vals, BONE_GPIO_MAX_LINES);
+  for (i = 0; i < lines.nr; i++) {
+    if (arg.bits & BIT_ULL(lines.ids[i])) {
+      __set_bit(i, vals);
+    }
+  }
+
+  ret = gpiod_set_array_value_cansleep(lines.nr, lines.descs, NULL, vals);
+  if (ret) {
+    goto unlock;
+  }
+
+  for (i = 0; i < lines.nr; i++) {
+    gpio_netlink_notify(gpio_drv_data.lines[lines.ids[i]]);
+  }
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return ret;
+}
+
+static int gpio_chip_open(struct inode* inode, struct file* filp)
+{
+  struct gpio_chip_file* cfile;
+
+  cfile = kzalloc(sizeof(*cfile), GFP_KERNEL);
+  if (!cfile) {
+    return -ENOMEM;
+  }
+
+  // Each open file can run its own waveform sequence and capture
+  cfile->seq = gpio_seq_alloc();
+  if (!cfile->seq) {
+    kfree(cfile);
+    return -ENOMEM;
+  }
+
+  cfile->capture = gpio_capture_alloc();
+  if (!cfile->capture) {
+    gpio_seq_free(cfile->seq);
+    kfree(cfile);
+    return -ENOMEM;
+  }
+
+  filp->private_data = cfile;
+
+  return nonseekable_open(inode, filp);
+}
+
+static int gpio_chip_release(struct inode* inode, struct file* filp)
+{
+  struct gpio_chip_file* cfile = filp->private_data;
+
+  gpio_capture_free(cfile->capture);
+  gpio_seq_free(cfile->seq);
+  kfree(cfile);
+
+  return 0;
+}
+
+static ssize_t gpio_chip_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
+{
+  return gpio_event_read(filp->private_data, filp, buff, count);
+}
+
+static int gpio_chip_mmap(struct file* filp, struct vm_area_struct* vma)
+{
+  struct gpio_chip_file* cfile = filp->private_data;
+
+  return gpio_capture_mmap(cfile->capture, vma);
+}
+
+static __poll_t gpio_chip_poll(struct file* filp, poll_table* wait)
+{
+  struct gpio_chip_file* cfile = filp->private_data;
+
+  return gpio_seq_poll(cfile->seq, filp, wait) | gpio_event_poll(cfile, filp, wait);
+}
+
+static long gpio_chip_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+  struct gpio_chip_file* cfile = filp->private_data;
+  u32 nr_lines;
+  u64 watch;
+
+  switch (cmd) {
+    case BONE_GPIO_IOC_GET_NLINES:
+      mutex_lock(&gpio_drv_data.lock);
+      nr_lines = gpio_drv_data.total_devices;
+      mutex_unlock(&gpio_drv_data.lock);
+      return put_user(nr_lines, (u32 __user*)arg);
+    case BONE_GPIO_IOC_GET_VALUES:
+      return gpio_chip_get_values((struct bone_gpio_values __user*)arg);
+    case BONE_GPIO_IOC_SET_VALUES:
+      return gpio_chip_set_values((struct bone_gpio_values __user*)arg);
+    case BONE_GPIO_IOC_SEQ_START:
+      return gpio_seq_start(cfile->seq, (struct bone_gpio_seq __user*)arg);
+    case BONE_GPIO_IOC_SEQ_STOP:
+      mutex_lock(&gpio_drv_data.lock);
+      gpio_seq_stop(cfile->seq);
+      mutex_unlock(&gpio_drv_data.lock);
+      return 0;
+    case BONE_GPIO_IOC_WATCH:
+      if (get_user(watch, (u64 __user*)arg)) {
+        return -EFAULT;
+      }
+      WRITE_ONCE(cfile->watch, watch);
+      return 0;
+    case BONE_GPIO_IOC_GET_MEASUREMENT:
+      return gpio_counter_ioctl_get((struct bone_gpio_measurement __user*)arg);
+    case BONE_GPIO_IOC_CAPTURE_START:
+      return gpio_capture_start(cfile->capture, (struct bone_gpio_capture __user*)arg);
+    case BONE_GPIO_IOC_CAPTURE_STOP:
+      mutex_lock(&gpio_drv_data.lock);
+      gpio_capture_stop(cfile->capture);
+      mutex_unlock(&gpio_drv_data.lock);
+      return 0;
+    default:
+      return -ENOTTY;
+  }
+}
+
+static const struct file_operations gpio_chip_fops = {
+  .owner = THIS_MODULE,
+  .open = gpio_chip_open,
+  .release = gpio_chip_release,
+  .read = gpio_chip_read,
+  .poll = gpio_chip_poll,
+  .mmap = gpio_chip_mmap,
+  .llseek = no_llseek,
+  .unlocked_ioctl = gpio_chip_ioctl,
+  .compat_ioctl = compat_ptr_ioctl,
+};
+
+int gpio_chip_init(void)
+{
+  return alloc_chrdev_region(&gpio_drv_data.chip_devt, 0, 1, "bone_gpiochip");
+}
+
+void gpio_chip_exit(void)
+{
+  unregister_chrdev_region(gpio_drv_data.chip_devt, 1);
+}
+
+// groups carries the line attributes of the compact layout, NULL otherwise
+int gpio_chip_create(struct device* parent, const struct attribute_group** groups)
+{
+  int ret;
+
+  gpio_drv_data.chip_cdev = cdev_alloc();
+  if (!gpio_drv_data.chip_cdev) {
+    return -ENOMEM;
+  }
+  gpio_drv_data.chip_cdev->ops = &gpio_chip_fops;
+  gpio_drv_data.chip_cdev->owner = THIS_MODULE;
+
+  ret = cdev_add(gpio_drv_data.chip_cdev, gpio_drv_data.chip_devt, 1);
+  if (ret) {
+    goto del_cdev;
+  }
+
+  gpio_drv_data.chip_dev = device_create_with_groups(gpio_drv_data.class_gpio, parent, gpio_drv_data.chip_devt, NULL, groups, "bone_gpiochip");
+  if (IS_ERR(gpio_drv_data.chip_dev)) {
+    ret = PTR_ERR(gpio_drv_data.chip_dev);
+    goto del_cdev;
+  }
+
+  return 0;
+
+del_cdev:
+  // Also drops the reference of cdev_alloc()
+  cdev_del(gpio_drv_data.chip_cdev);
+  gpio_drv_data.chip_cdev = NULL;
+  return ret;
+}
+
+void gpio_chip_destroy(void)
+{
+  device_destroy(gpio_drv_data.class_gpio, gpio_drv_data.chip_devt);
+  cdev_del(gpio_drv_data.chip_cdev);
+  gpio_drv_data.chip_cdev = NULL;
+}
@@ -0,0 +1,302 @@
+#include <linux/bitmap.h>
+#include <linux/mm.h>
+#include "gpio_sysfs.h"
+
+// Compact layout. With compact_layout set, probe creates no device per line, which
+// saves a struct device, a kobject, a sysfs directory with its attribute files and
+// a uevent for every line. The lines are reached through array attributes of the
+// bone_gpiochip device instead:
+//   nr_lines    number of lines
+//   labels      "<line> <label>" per line, a binary attribute so it isn't capped
+//               at a page however many lines there are
+//   values      bitmap of the line values; writing one drives the output lines
+//   directions  bitmap of the output lines; writing one switches directions
+//   set_line    "<line> <value>" drives a single output line
+// Bitmaps use the kernel's hex format ("%*pb", comma separated 32 bit words) with
+// bit n for line n.
+
+static ssize_t nr_lines_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  int nr_lines;
+
+  mutex_lock(&gpio_drv_data.lock);
+  nr_lines = gpio_drv_data.total_devices;
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return sprintf(buf, "%d\n", nr_lines);
+}
+
+static ssize_t labels_read(struct file* filp, struct kobject* kobj, struct bin_attribute* attr,
+                           char* buf, loff_t off, size_t count)
+{
+  struct gpiodev_private_data* dev_data;
+  size_t len = 0;
+  ssize_t ret;
+  char* text;
+  int i;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  // Room for the longest index and label on every line
+  text = kvmalloc(gpio_drv_data.total_devices * (sizeof(dev_data->label) + 12) + 1, GFP_KERNEL);
+  if (!text) {
+    mutex_unlock(&gpio_drv_data.lock);
+    return -ENOMEM;
+  }
+
+  for (i = 0; i < gpio_drv_data.total_devices; i++) {
+    dev_data = gpio_drv_data.lines[i];
+    len += sprintf(text + len, "%d %s\n", i, dev_data->label);
+  }
+
+  mutex_unlock(&gpio_drv_data.lock);
+
+  ret = memory_read_from_buffer(buf, count, &off, text, len);
+  kvfree(text);
+
+  return ret;
+}
+
+static ssize_t values_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpio_desc** descs;
+  unsigned long* vals;
+  int nr_lines;
+  int ret;
+  int i;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  nr_lines = gpio_drv_data.total_devices;
+  descs = kmalloc_array(nr_lines, sizeof(*descs), GFP_KERNEL);
+  vals = bitmap_zalloc(nr_lines, GFP_KERNEL);
+  if (!descs || !vals) {
+    ret = -ENOMEM;
+    goto unlock;
+  }
+
+  for (i = 0; i < nr_lines; i++) {
+    descs[i] = gpio_drv_data.lines[i]->desc;
+  }
+
+  // Lines on the same controller are read together, a register read each
+  ret = nr_lines ? gpiod_get_array_value_cansleep(nr_lines, descs, NULL, vals) : 0;
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (!ret) {
+    ret = sprintf(buf, "%*pb\n", nr_lines, vals);
+  }
+
+  bitmap_free(vals);
+  kfree(descs);
+
+  return ret;
+}
+
+static ssize_t values_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data;
+  struct gpio_desc** descs;
+  unsigned long* wanted;
+  unsigned long* vals;
+  int nr_lines;
+  int nr = 0;
+  int ret;
+  int i;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  nr_lines = gpio_drv_data.total_devices;
+  descs = kmalloc_array(nr_lines, sizeof(*descs), GFP_KERNEL);
+  wanted = bitmap_zalloc(nr_lines, GFP_KERNEL);
+  vals = bitmap_zalloc(nr_lines, GFP_KERNEL);
+  if (!descs || !wanted || !vals) {
+    ret = -ENOMEM;
+    goto unlock;
+  }
+
+  ret = bitmap_parse(buf, count, wanted, nr_lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  // Inputs and PWM outputs keep what they have, the other outputs are driven
+  // together
+  for (i = 0; i < nr_lines; i++) {
+    dev_data = gpio_drv_data.lines[i];
+    if (READ_ONCE(dev_data->pwm_period_ns) || gpiod_get_direction(dev_data->desc) != 0) {
+      continue;
+    }
+    descs[nr] = dev_data->desc;
+    __assign_bit(nr, vals, test_bit(i, wanted));
+    nr++;
+  }
+
+  ret = nr ? gpiod_set_array_value_cansleep(nr, descs, NULL, vals) : 0;
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  bitmap_free(vals);
+  bitmap_free(wanted);
+  kfree(descs);
+
+  return ret ? ret : count;
+}
+
+static ssize_t directions_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  unsigned long* outputs;
+  int nr_lines;
+  int ret = 0;
+  int dir;
+  int i;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  nr_lines = gpio_drv_data.total_devices;
+  outputs = bitmap_zalloc(nr_lines, GFP_KERNEL);
+  if (!outputs) {
+    ret = -ENOMEM;
+    goto unlock;
+  }
+
+  // gpiod_get_direction() returns 0 for output
+  for (i = 0; i < nr_lines; i++) {
+    dir = gpiod_get_direction(gpio_drv_data.lines[i]->desc);
+    if (dir < 0) {
+      ret = dir;
+      goto unlock;
+    }
+    __assign_bit(i, outputs, dir == 0);
+  }
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (!ret) {
+    ret = sprintf(buf, "%*pb\n", nr_lines, outputs);
+  }
+
+  bitmap_free(outputs);
+
+  return ret;
+}
+
+static ssize_t directions_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data;
+  unsigned long* outputs;
+  int nr_lines;
+  int ret;
+  int dir;
+  int i;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  nr_lines = gpio_drv_data.total_devices;
+  outputs = bitmap_zalloc(nr_lines, GFP_KERNEL);
+  if (!outputs) {
+    ret = -ENOMEM;
+    goto unlock;
+  }
+
+  ret = bitmap_parse(buf, count, outputs, nr_lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  // Only the lines that change, each under its own lock like direction_store.
+  // Stops at the first line that fails, the ones before it stay switched.
+  for (i = 0; i < nr_lines && !ret; i++) {
+    dev_data = gpio_drv_data.lines[i];
+
+    mutex_lock(&dev_data->pcd_lock);
+
+    dir = gpiod_get_direction(dev_data->desc);
+    if (dir < 0) {
+      ret = dir;
+    } else if ((dir == 0) != test_bit(i, outputs)) {
+      if (dev_data->pwm_period_ns) {
+        ret = -EBUSY;
+      } else if (test_bit(i, outputs)) {
+        ret = gpiod_direction_output(dev_data->desc, 0);
+      } else {
+        ret = gpiod_direction_input(dev_data->desc);
+      }
+    }
+
+    mutex_unlock(&dev_data->pcd_lock);
+  }
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  bitmap_free(outputs);
+
+  return ret ? ret : count;
+}
+
+static ssize_t set_line_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data;
+  unsigned int line;
+  int value;
+  int ret = 0;
+
+  if (sscanf(buf, "%u %d", &line, &value) != 2) {
+    return -EINVAL;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  if (line >= gpio_drv_data.total_devices) {
+    ret = -EINVAL;
+    goto unlock;
+  }
+
+  dev_data = gpio_drv_data.lines[line];
+  if (READ_ONCE(dev_data->pwm_period_ns)) {
+    ret = -EBUSY;
+    goto unlock;
+  }
+
+  gpiod_set_value_cansleep(dev_data->desc, value);
+  gpio_netlink_notify(dev_data);
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RO(nr_lines);
+static DEVICE_ATTR_RW(values);
+static DEVICE_ATTR_RW(directions);
+static DEVICE_ATTR_WO(set_line);
+static BIN_ATTR_RO(labels, 0);
+
+static struct attribute* gpio_compact_attrs[] = {
+  &dev_attr_nr_lines.attr,
+  &dev_attr_values.attr,
+  &dev_attr_directions.attr,
+  &dev_attr_set_line.attr,
+  NULL,
+};
+
+static struct bin_attribute* gpio_compact_bin_attrs[] = {
+  &bin_attr_labels,
+  NULL,
+};
+
+static const struct attribute_group gpio_compact_group = {
+  .attrs = gpio_compact_attrs,
+  .bin_attrs = gpio_compact_bin_attrs,
+};
+
+const struct attribute_group* gpio_compact_groups[] = {
+  &gpio_compact_group,
+  NULL,
+};
@@ -0,0 +1,166 @@
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include "gpio_sysfs.h"
+
+// Counter mode. The irq handler counts every edge and adds the time since the
+// previous one to the high or low pulse total; at the end of each window the
+// totals become a frequency and mean pulse widths, which are kept for the
+// attributes and the ioctl and announced with a BONE_GPIO_EVENT_MEASUREMENT event.
+// User space does nothing per edge.
+
+// From the irq handler (or the nested irq thread)
+void gpio_counter_edge(struct gpiodev_private_data* dev_data, u64 timestamp_ns, int value)
+{
+  struct gpio_counter* counter = &dev_data->counter;
+  unsigned long flags;
+  u64 width;
+
+  spin_lock_irqsave(&counter->lock, flags);
+
+  // The line is now high, so the pulse that just ended was low and vice versa
+  if (counter->last_edge_ns) {
+    width = timestamp_ns - counter->last_edge_ns;
+    if (value) {
+      counter->low_sum_ns += width;
+      counter->low_pulses++;
+    } else {
+      counter->high_sum_ns += width;
+      counter->high_pulses++;
+    }
+  }
+  counter->last_edge_ns = timestamp_ns;
+
+  counter->edges++;
+  if (value) {
+    counter->rising++;
+  }
+
+  spin_unlock_irqrestore(&counter->lock, flags);
+}
+
+static enum hrtimer_restart gpio_counter_window(struct hrtimer* timer)
+{
+  struct gpio_counter* counter = container_of(timer, struct gpio_counter, window_timer);
+  struct gpiodev_private_data* dev_data = container_of(counter, struct gpiodev_private_data, counter);
+  struct bone_gpio_measurement* result = &counter->result;
+  u64 now = ktime_get_ns();
+  unsigned long flags;
+
+  spin_lock_irqsave(&counter->lock, flags);
+
+  result->timestamp_ns = now;
+  result->window_ns = counter->window_ns;
+  result->frequency_millihz = mul_u64_u64_div_u64(counter->rising, NSEC_PER_SEC * 1000ULL, counter->window_ns);
+  result->high_ns = counter->high_pulses ? div_u64(counter->high_sum_ns, counter->high_pulses) : 0;
+  result->low_ns = counter->low_pulses ? div_u64(counter->low_sum_ns, counter->low_pulses) : 0;
+  result->edges = counter->edges;
+
+  // A pulse running across the window boundary counts in the window it ends in
+  counter->edges = 0;
+  counter->rising = 0;
+  counter->high_sum_ns = 0;
+  counter->high_pulses = 0;
+  counter->low_sum_ns = 0;
+  counter->low_pulses = 0;
+
+  spin_unlock_irqrestore(&counter->lock, flags);
+
+  gpio_event_record(dev_data, now, BONE_GPIO_EVENT_MEASUREMENT);
+
+  hrtimer_forward_now(timer, ns_to_ktime(counter->window_ns));
+
+  return HRTIMER_RESTART;
+}
+
+void gpio_counter_init(struct gpiodev_private_data* dev_data)
+{
+  spin_lock_init(&dev_data->counter.lock);
+  hrtimer_init(&dev_data->counter.window_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  dev_data->counter.window_timer.function = gpio_counter_window;
+}
+
+// Starts, restarts or (window_ns 0) stops counting, with pcd_lock held
+int gpio_counter_set_window(struct gpiodev_private_data* dev_data, struct device* dev, u64 window_ns)
+{
+  struct gpio_counter* counter = &dev_data->counter;
+  unsigned long flags;
+  int ret;
+
+  if (window_ns == counter->window_ns) {
+    return 0;
+  }
+
+  hrtimer_cancel(&counter->window_timer);
+
+  spin_lock_irqsave(&counter->lock, flags);
+  memset(&counter->result, 0, sizeof(counter->result));
+  counter->last_edge_ns = 0;
+  counter->edges = 0;
+  counter->rising = 0;
+  counter->high_sum_ns = 0;
+  counter->high_pulses = 0;
+  counter->low_sum_ns = 0;
+  counter->low_pulses = 0;
+  WRITE_ONCE(counter->window_ns, window_ns);
+  spin_unlock_irqrestore(&counter->lock, flags);
+
+  // Counting needs the interrupt on both edges
+  ret = gpio_event_request_irq(dev_data, dev);
+  if (ret) {
+    // Put the interrupt back the way edge and debounce_us want it
+    WRITE_ONCE(counter->window_ns, 0);
+    gpio_event_request_irq(dev_data, dev);
+    return ret;
+  }
+
+  if (window_ns) {
+    hrtimer_start(&counter->window_timer, ns_to_ktime(window_ns), HRTIMER_MODE_REL);
+  }
+
+  return 0;
+}
+
+void gpio_counter_read(struct gpiodev_private_data* dev_data, struct bone_gpio_measurement* result)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&dev_data->counter.lock, flags);
+  *result = dev_data->counter.result;
+  spin_unlock_irqrestore(&dev_data->counter.lock, flags);
+
+  result->line = dev_data->id;
+}
+
+// Before the events FIFO goes away, the window timer queues on it
+void gpio_counter_release(struct gpiodev_private_data* dev_data)
+{
+  hrtimer_cancel(&dev_data->counter.window_timer);
+  dev_data->counter.window_ns = 0;
+}
+
+long gpio_counter_ioctl_get(struct bone_gpio_measurement __user* uarg)
+{
+  struct bone_gpio_measurement result;
+  u32 line;
+  int ret = 0;
+
+  if (get_user(line, &uarg->line)) {
+    return -EFAULT;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+  if (line < gpio_drv_data.total_devices) {
+    gpio_counter_read(gpio_drv_data.lines[line], &result);
+  } else {
+    ret = -EINVAL;
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (ret) {
+    return ret;
+  }
+
+  return copy_to_user(uarg, &result, sizeof(result)) ? -EFAULT : 0;
+}
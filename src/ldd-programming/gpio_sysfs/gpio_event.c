@@ -0,0 +1,394 @@
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/sysfs.h>
+#include <linux/kernfs.h>
+#include "gpio_sysfs.h"
+
+// Edge events. The irq handler timestamps each edge and queues it on the line's
+// FIFO, then wakes chip device readers and poll() on the line's value attribute.
+// Readers drain the FIFOs of the lines they watch, oldest event first. Lines with
+// a software debounce go through an hrtimer filter first.
+
+static unsigned int event_fifo_size = 1024;
+module_param(event_fifo_size, uint, 0444);
+MODULE_PARM_DESC(event_fifo_size, "Edge events queued per line before they are dropped (rounded up to a power of 2)");
+
+void gpio_event_record(struct gpiodev_private_data* dev_data, u64 timestamp_ns, u32 id)
+{
+  struct gpio_event event = {
+    .timestamp_ns = timestamp_ns,
+    .id = id,
+  };
+  unsigned long flags;
+
+  // Edges and counter windows queue from different contexts, possibly on
+  // different CPUs; readers are the single consumer and don't need the lock
+  spin_lock_irqsave(&dev_data->event_lock, flags);
+  event.seqno = dev_data->event_seqno++;
+  // A full FIFO drops the new event, readers see the gap in seqno
+  kfifo_put(&dev_data->events->fifo, event);
+  spin_unlock_irqrestore(&dev_data->event_lock, flags);
+
+  atomic_inc(&gpio_drv_data.event_count);
+  wake_up_interruptible_poll(&gpio_drv_data.event_wait, EPOLLIN | EPOLLRDNORM);
+  kernfs_notify(dev_data->value_kn);
+}
+
+static void gpio_event_edge(struct gpiodev_private_data* dev_data, u64 timestamp_ns, int value)
+{
+  u32 id;
+
+  if (dev_data->counter.window_ns) {
+    gpio_counter_edge(dev_data, timestamp_ns, value);
+  }
+
+  // The interrupt says which edge it was when it only fires on one, otherwise
+  // the line has to be read, and the edge may not be one that is reported
+  switch (dev_data->irq_flags) {
+    case IRQF_TRIGGER_RISING:
+      id = BONE_GPIO_EVENT_RISING;
+      break;
+    case IRQF_TRIGGER_FALLING:
+      id = BONE_GPIO_EVENT_FALLING;
+      break;
+    default:
+      id = value ? BONE_GPIO_EVENT_RISING : BONE_GPIO_EVENT_FALLING;
+      break;
+  }
+
+  if ((id == BONE_GPIO_EVENT_RISING && (dev_data->edge & IRQF_TRIGGER_RISING)) ||
+      (id == BONE_GPIO_EVENT_FALLING && (dev_data->edge & IRQF_TRIGGER_FALLING))) {
+    gpio_event_record(dev_data, timestamp_ns, id);
+  }
+}
+
+static irqreturn_t gpio_event_hardirq(int irq, void* data)
+{
+  struct gpiodev_private_data* dev_data = data;
+  u64 now = ktime_get_ns();
+
+  // Every edge pushes the filter out, only the last one of a burst gets through.
+  // The counter measures the raw signal.
+  if (dev_data->sw_debounce) {
+    if (dev_data->counter.window_ns) {
+      gpio_counter_edge(dev_data, now, gpiod_get_value(dev_data->desc));
+    }
+    WRITE_ONCE(dev_data->debounce_ts, now);
+    hrtimer_start(&dev_data->debounce_timer, us_to_ktime(dev_data->debounce_us), HRTIMER_MODE_REL);
+    return IRQ_HANDLED;
+  }
+
+  gpio_event_edge(dev_data, now, gpiod_get_value(dev_data->desc));
+
+  return IRQ_HANDLED;
+}
+
+// Only runs for lines on controllers that sleep, whose interrupts are nested in
+// the controller's irq thread and never reach gpio_event_hardirq()
+static irqreturn_t gpio_event_thread(int irq, void* data)
+{
+  struct gpiodev_private_data* dev_data = data;
+
+  gpio_event_edge(dev_data, ktime_get_ns(), gpiod_get_value_cansleep(dev_data->desc));
+
+  return IRQ_HANDLED;
+}
+
+// The line has been quiet for debounce_us since its last edge
+static enum hrtimer_restart gpio_event_debounced(struct hrtimer* timer)
+{
+  struct gpiodev_private_data* dev_data = container_of(timer, struct gpiodev_private_data, debounce_timer);
+  int value = gpiod_get_value(dev_data->desc);
+
+  // Back where it was: a glitch
+  if (value < 0 || value == dev_data->stable_value) {
+    return HRTIMER_NORESTART;
+  }
+  WRITE_ONCE(dev_data->stable_value, value);
+
+  // The filter listens to both edges, report only the ones asked for
+  if ((value && (dev_data->edge & IRQF_TRIGGER_RISING)) || (!value && (dev_data->edge & IRQF_TRIGGER_FALLING))) {
+    gpio_event_record(dev_data, READ_ONCE(dev_data->debounce_ts), value ? BONE_GPIO_EVENT_RISING : BONE_GPIO_EVENT_FALLING);
+  }
+
+  return HRTIMER_NORESTART;
+}
+
+void gpio_event_init(struct gpiodev_private_data* dev_data)
+{
+  hrtimer_init(&dev_data->debounce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  dev_data->debounce_timer.function = gpio_event_debounced;
+  spin_lock_init(&dev_data->event_lock);
+}
+
+static struct gpio_event_fifo* gpio_event_fifo_alloc(void)
+{
+  struct gpio_event_fifo* events;
+
+  events = kzalloc(sizeof(*events), GFP_KERNEL);
+  if (!events) {
+    return NULL;
+  }
+
+  if (kfifo_alloc(&events->fifo, event_fifo_size, GFP_KERNEL)) {
+    kfree(events);
+    return NULL;
+  }
+
+  return events;
+}
+
+static void gpio_event_free_irq(struct gpiodev_private_data* dev_data)
+{
+  if (!dev_data->irq_requested) {
+    return;
+  }
+
+  free_irq(dev_data->irq, dev_data);
+  hrtimer_cancel(&dev_data->debounce_timer);
+  dev_data->irq_requested = false;
+}
+
+// (Re)requests the interrupt for the current edge, debounce and counter settings,
+// with pcd_lock held. The software filter and the counter need to see every edge
+// even when none is reported.
+int gpio_event_request_irq(struct gpiodev_private_data* dev_data, struct device* dev)
+{
+  struct gpio_event_fifo* events;
+  unsigned long flags;
+  int irq;
+  int ret;
+
+  gpio_event_free_irq(dev_data);
+
+  if (!dev_data->edge && !dev_data->sw_debounce && !dev_data->counter.window_ns) {
+    return 0;
+  }
+
+  irq = gpiod_to_irq(dev_data->desc);
+  if (irq < 0) {
+    return irq;
+  }
+
+  if (!dev_data->events) {
+    events = gpio_event_fifo_alloc();
+    if (!events) {
+      return -ENOMEM;
+    }
+    // Readers look at the FIFO without pcd_lock, it must be complete before
+    // they can see it
+    smp_store_release(&dev_data->events, events);
+  }
+
+  if (!dev_data->value_kn) {
+    dev_data->value_kn = sysfs_get_dirent(dev->kobj.sd, "value");
+    if (!dev_data->value_kn) {
+      return -ENOENT;
+    }
+  }
+
+  flags = dev_data->edge;
+  if (dev_data->sw_debounce || dev_data->counter.window_ns) {
+    flags = IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING;
+  }
+  if (dev_data->sw_debounce) {
+    dev_data->stable_value = gpiod_get_value(dev_data->desc);
+  }
+  dev_data->irq_flags = flags;
+
+  ret = request_threaded_irq(irq, gpio_event_hardirq, gpio_event_thread, flags | IRQF_ONESHOT,
+                             dev_data->label, dev_data);
+  if (ret) {
+    return ret;
+  }
+  dev_data->irq = irq;
+  dev_data->irq_requested = true;
+
+  return 0;
+}
+
+// Changes the edges the line reports (0 for none), with pcd_lock held
+int gpio_event_set_edge(struct gpiodev_private_data* dev_data, struct device* dev, unsigned long edge)
+{
+  int ret;
+
+  if (edge == dev_data->edge) {
+    return 0;
+  }
+
+  // The handlers pick the event id from edge, set it before they can run
+  dev_data->edge = edge;
+  ret = gpio_event_request_irq(dev_data, dev);
+  if (ret) {
+    dev_data->edge = 0;
+  }
+
+  return ret;
+}
+
+// Sets the debounce time, with pcd_lock held. The controller does the filtering
+// if it can, otherwise an hrtimer restarted on every edge lets a new value through
+// only once the line has held it for debounce_us. That needs the value to be
+// readable from interrupt context.
+int gpio_event_set_debounce(struct gpiodev_private_data* dev_data, struct device* dev, unsigned int debounce_us)
+{
+  bool sw_debounce = false;
+  int ret;
+
+  ret = gpiod_set_debounce(dev_data->desc, debounce_us);
+  if (ret == -ENOTSUPP || ret == -EOPNOTSUPP) {
+    if (debounce_us && gpiod_cansleep(dev_data->desc)) {
+      return -EOPNOTSUPP;
+    }
+    sw_debounce = debounce_us != 0;
+  } else if (ret) {
+    return ret;
+  }
+
+  // Nothing the irq handlers look at may change under them
+  gpio_event_free_irq(dev_data);
+
+  dev_data->debounce_us = debounce_us;
+  WRITE_ONCE(dev_data->sw_debounce, sw_debounce);
+
+  ret = gpio_event_request_irq(dev_data, dev);
+  if (ret) {
+    WRITE_ONCE(dev_data->sw_debounce, false);
+  }
+
+  return ret;
+}
+
+// After the line's device is unregistered, once readers can no longer reach it
+void gpio_event_release(struct gpiodev_private_data* dev_data)
+{
+  gpio_event_free_irq(dev_data);
+  dev_data->edge = 0;
+
+  if (dev_data->events) {
+    kfifo_free(&dev_data->events->fifo);
+    kfree(dev_data->events);
+    dev_data->events = NULL;
+  }
+
+  sysfs_put(dev_data->value_kn);
+  dev_data->value_kn = NULL;
+}
+
+// Takes the oldest event of the watched lines, with gpio_drv_data.lock held. The
+// lock serialises readers, so each FIFO has one consumer and one producer (the irq
+// handler) and needs no lock of its own.
+static bool gpio_event_pop(u64 watch, struct bone_gpio_event* event)
+{
+  struct gpiodev_private_data* dev_data;
+  struct gpiodev_private_data* oldest = NULL;
+  struct gpio_event_fifo* events;
+  struct gpio_event head;
+  struct gpio_event first;
+  unsigned int i;
+
+  for (i = 0; i < min(gpio_drv_data.total_devices, BONE_GPIO_MAX_LINES); i++) {
+    if (!(watch & BIT_ULL(i))) {
+      continue;
+    }
+
+    dev_data = gpio_drv_data.lines[i];
+    events = smp_load_acquire(&dev_data->events);
+    if (!events || !kfifo_peek(&events->fifo, &head)) {
+      continue;
+    }
+
+    if (!oldest || head.timestamp_ns < first.timestamp_ns) {
+      oldest = dev_data;
+      first = head;
+    }
+  }
+
+  if (!oldest) {
+    return false;
+  }
+
+  kfifo_skip(&oldest->events->fifo);
+
+  event->timestamp_ns = first.timestamp_ns;
+  event->line = oldest->id;
+  event->id = first.id;
+  event->seqno = first.seqno;
+  event->padding = 0;
+
+  return true;
+}
+
+ssize_t gpio_event_read(struct gpio_chip_file* cfile, struct file* filp, char __user* buff, size_t count)
+{
+  struct bone_gpio_event event;
+  size_t copied = 0;
+  bool popped;
+  int seen;
+  int ret;
+
+  if (count < sizeof(event)) {
+    return -EINVAL;
+  }
+
+  while (copied + sizeof(event) <= count) {
+    // Sampled before looking, so an event queued in between ends the wait below
+    seen = atomic_read(&gpio_drv_data.event_count);
+
+    mutex_lock(&gpio_drv_data.lock);
+    popped = gpio_event_pop(READ_ONCE(cfile->watch), &event);
+    mutex_unlock(&gpio_drv_data.lock);
+
+    if (!popped) {
+      // Whatever is queued has been returned, block only for the first event
+      if (copied) {
+        break;
+      }
+
+      if (filp->f_flags & O_NONBLOCK) {
+        return -EAGAIN;
+      }
+
+      ret = wait_event_interruptible(gpio_drv_data.event_wait, atomic_read(&gpio_drv_data.event_count) != seen);
+      if (ret) {
+        return ret;
+      }
+      continue;
+    }
+
+    if (copy_to_user(buff + copied, &event, sizeof(event))) {
+      return copied ? copied : -EFAULT;
+    }
+    copied += sizeof(event);
+  }
+
+  return copied;
+}
+
+__poll_t gpio_event_poll(struct gpio_chip_file* cfile, struct file* filp, poll_table* wait)
+{
+  struct gpiodev_private_data* dev_data;
+  struct gpio_event_fifo* events;
+  u64 watch = READ_ONCE(cfile->watch);
+  __poll_t mask = 0;
+  unsigned int i;
+
+  poll_wait(filp, &gpio_drv_data.event_wait, wait);
+
+  mutex_lock(&gpio_drv_data.lock);
+  for (i = 0; i < min(gpio_drv_data.total_devices, BONE_GPIO_MAX_LINES); i++) {
+    if (!(watch & BIT_ULL(i))) {
+      continue;
+    }
+
+    dev_data = gpio_drv_data.lines[i];
+    events = smp_load_acquire(&dev_data->events);
+    if (events && !kfifo_is_empty(&events->fifo)) {
+      mask = EPOLLIN | EPOLLRDNORM;
+      break;
+    }
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return mask;
+}
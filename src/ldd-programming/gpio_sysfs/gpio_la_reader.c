@@ -0,0 +1,127 @@
+/*
+ * Streams a logic analyzer capture of bone_gpios lines to a file. The driver
+ * samples the lines from an hrtimer into a ring this maps; samples are written
+ * out raw, one little endian uint64_t each with bit n for line n, until SIGINT.
+ *
+ *   gcc -O2 -o gpio_la_reader gpio_la_reader.c
+ *   ./gpio_la_reader <mask> <period_ns> <nr_samples> <out_file>
+ *   ./gpio_la_reader 0x78 20000 65536 capture.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "bone_gpio_ioctl.h"
+
+static volatile sig_atomic_t stop;
+
+static void on_sigint(int sig)
+{
+  stop = 1;
+}
+
+// Writes out everything between tail and head, then hands the slots back
+static int drain(struct bone_gpio_ring *ring, const uint64_t *samples, FILE *out, uint64_t *total)
+{
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint32_t tail = ring->tail;
+  uint32_t idx, chunk;
+
+  while (tail != head) {
+    // Up to the end of the ring at most, the rest wraps to the start
+    idx = tail & (ring->nr_samples - 1);
+    chunk = head - tail;
+    if (chunk > ring->nr_samples - idx) {
+      chunk = ring->nr_samples - idx;
+    }
+
+    if (fwrite(&samples[idx], sizeof(*samples), chunk, out) != chunk) {
+      perror("fwrite");
+      return -1;
+    }
+
+    tail += chunk;
+    *total += chunk;
+  }
+
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct bone_gpio_capture cap = { 0 };
+  struct bone_gpio_ring *ring;
+  struct timespec nap;
+  uint64_t *samples;
+  uint64_t total = 0;
+  uint64_t nap_ns;
+  FILE *out;
+  int fd;
+
+  if (argc != 5) {
+    fprintf(stderr, "usage: %s <mask> <period_ns> <nr_samples> <out_file>\n", argv[0]);
+    return 1;
+  }
+
+  cap.mask = strtoull(argv[1], NULL, 0);
+  cap.period_ns = strtoull(argv[2], NULL, 0);
+  cap.nr_samples = strtoul(argv[3], NULL, 0);
+
+  out = fopen(argv[4], "wb");
+  if (!out) {
+    perror(argv[4]);
+    return 1;
+  }
+
+  fd = open(BONE_GPIO_CHIP_PATH, O_RDWR);
+  if (fd < 0) {
+    perror(BONE_GPIO_CHIP_PATH);
+    return 1;
+  }
+
+  if (ioctl(fd, BONE_GPIO_IOC_CAPTURE_START, &cap) < 0) {
+    perror("BONE_GPIO_IOC_CAPTURE_START");
+    return 1;
+  }
+
+  ring = mmap(NULL, cap.mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  samples = (uint64_t *)((char *)ring + ring->data_offset);
+
+  signal(SIGINT, on_sigint);
+
+  // Waking up every quarter ring leaves plenty of headroom before it overruns
+  nap_ns = cap.period_ns * (cap.nr_samples / 4 ? cap.nr_samples / 4 : 1);
+  nap.tv_sec = nap_ns / 1000000000;
+  nap.tv_nsec = nap_ns % 1000000000;
+
+  while (!stop) {
+    if (drain(ring, samples, out, &total)) {
+      break;
+    }
+    nanosleep(&nap, NULL);
+  }
+
+  ioctl(fd, BONE_GPIO_IOC_CAPTURE_STOP);
+  drain(ring, samples, out, &total);
+
+  printf("%llu samples, %u overruns, %u missed periods\n",
+         (unsigned long long)total, ring->overruns, ring->missed);
+
+  munmap(ring, cap.mmap_size);
+  close(fd);
+  fclose(out);
+
+  return 0;
+}
@@ -0,0 +1,274 @@
+#include <net/genetlink.h>
+#include "gpio_sysfs.h"
+#include "gpio_netlink.h"
+
+#define BONE_GPIO_NL_MCGRP_EVENTS 0
+
+static const struct nla_policy gpio_nl_policy[BONE_GPIO_ATTR_MAX + 1] = {
+  [BONE_GPIO_ATTR_LINE] = { .type = NLA_NESTED },
+  [BONE_GPIO_ATTR_LINE_ID] = { .type = NLA_U32 },
+  [BONE_GPIO_ATTR_DIRECTION] = NLA_POLICY_MAX(NLA_U8, BONE_GPIO_DIR_OUT),
+  [BONE_GPIO_ATTR_VALUE] = NLA_POLICY_MAX(NLA_U8, 1),
+};
+
+static int gpio_nl_get_doit(struct sk_buff* skb, struct genl_info* info);
+static int gpio_nl_get_dumpit(struct sk_buff* skb, struct netlink_callback* cb);
+static int gpio_nl_set_doit(struct sk_buff* skb, struct genl_info* info);
+
+static const struct genl_ops gpio_nl_ops[] = {
+  {
+    .cmd = BONE_GPIO_CMD_GET,
+    .doit = gpio_nl_get_doit,
+    .dumpit = gpio_nl_get_dumpit,
+  },
+  {
+    .cmd = BONE_GPIO_CMD_SET,
+    .doit = gpio_nl_set_doit,
+    .flags = GENL_ADMIN_PERM,
+  },
+};
+
+static const struct genl_multicast_group gpio_nl_mcgrps[] = {
+  [BONE_GPIO_NL_MCGRP_EVENTS] = { .name = BONE_GPIO_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family gpio_nl_family = {
+  .name = BONE_GPIO_GENL_NAME,
+  .version = BONE_GPIO_GENL_VERSION,
+  .maxattr = BONE_GPIO_ATTR_MAX,
+  .policy = gpio_nl_policy,
+  .ops = gpio_nl_ops,
+  .n_ops = ARRAY_SIZE(gpio_nl_ops),
+  .resv_start_op = __BONE_GPIO_CMD_MAX,
+  .mcgrps = gpio_nl_mcgrps,
+  .n_mcgrps = ARRAY_SIZE(gpio_nl_mcgrps),
+  .module = THIS_MODULE,
+};
+
+// With gpio_drv_data.lock held
+static struct gpiodev_private_data* gpio_nl_line(u32 id)
+{
+  if (id >= gpio_drv_data.total_devices) {
+    return NULL;
+  }
+
+  return gpio_drv_data.lines[id];
+}
+
+static int gpio_nl_fill(struct sk_buff* skb, struct gpiodev_private_data* dev_data, u32 portid, u32 seq, int flags, u8 cmd)
+{
+  void* hdr;
+  int dir;
+  int value;
+
+  mutex_lock(&dev_data->pcd_lock);
+  dir = gpiod_get_direction(dev_data->desc);
+  value = gpiod_get_value_cansleep(dev_data->desc);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  if (dir < 0) {
+    return dir;
+  }
+
+  hdr = genlmsg_put(skb, portid, seq, &gpio_nl_family, flags, cmd);
+  if (!hdr) {
+    return -EMSGSIZE;
+  }
+
+  // gpiod_get_direction() returns 1 for input, 0 for output
+  if (nla_put_u32(skb, BONE_GPIO_ATTR_LINE_ID, dev_data->id) ||
+      nla_put_string(skb, BONE_GPIO_ATTR_LABEL, dev_data->label) ||
+      nla_put_u8(skb, BONE_GPIO_ATTR_DIRECTION, dir ? BONE_GPIO_DIR_IN : BONE_GPIO_DIR_OUT) ||
+      nla_put_u8(skb, BONE_GPIO_ATTR_VALUE, !!value)) {
+    genlmsg_cancel(skb, hdr);
+    return -EMSGSIZE;
+  }
+
+  genlmsg_end(skb, hdr);
+
+  return 0;
+}
+
+static int gpio_nl_get_doit(struct sk_buff* skb, struct genl_info* info)
+{
+  struct gpiodev_private_data* dev_data;
+  struct sk_buff* msg;
+  int ret;
+
+  if (GENL_REQ_ATTR_CHECK(info, BONE_GPIO_ATTR_LINE_ID)) {
+    return -EINVAL;
+  }
+
+  msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+  if (!msg) {
+    return -ENOMEM;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+  dev_data = gpio_nl_line(nla_get_u32(info->attrs[BONE_GPIO_ATTR_LINE_ID]));
+  if (dev_data) {
+    ret = gpio_nl_fill(msg, dev_data, info->snd_portid, info->snd_seq, 0, BONE_GPIO_CMD_GET);
+  } else {
+    NL_SET_BAD_ATTR(info->extack, info->attrs[BONE_GPIO_ATTR_LINE_ID]);
+    ret = -ENODEV;
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  if (ret) {
+    nlmsg_free(msg);
+    return ret;
+  }
+
+  return genlmsg_reply(msg, info);
+}
+
+// Resumes from the line in cb->args[0]
+static int gpio_nl_get_dumpit(struct sk_buff* skb, struct netlink_callback* cb)
+{
+  struct gpiodev_private_data* dev_data;
+  int ret = 0;
+
+  mutex_lock(&gpio_drv_data.lock);
+  while ((dev_data = gpio_nl_line(cb->args[0]))) {
+    ret = gpio_nl_fill(skb, dev_data, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq, NLM_F_MULTI, BONE_GPIO_CMD_GET);
+    if (ret) {
+      break;
+    }
+    cb->args[0]++;
+  }
+  mutex_unlock(&gpio_drv_data.lock);
+
+  // A full skb just means the rest goes in the next part
+  if (ret == -EMSGSIZE && skb->len) {
+    return skb->len;
+  }
+
+  return ret ? ret : skb->len;
+}
+
+// Looks up one BONE_GPIO_ATTR_LINE nest, with gpio_drv_data.lock held
+static struct gpiodev_private_data* gpio_nl_parse_line(const struct nlattr* nla, struct nlattr** tb, struct netlink_ext_ack* extack)
+{
+  struct gpiodev_private_data* dev_data;
+  int ret;
+
+  ret = nla_parse_nested(tb, BONE_GPIO_ATTR_MAX, nla, gpio_nl_policy, extack);
+  if (ret) {
+    return ERR_PTR(ret);
+  }
+
+  if (NL_REQ_ATTR_CHECK(extack, nla, tb, BONE_GPIO_ATTR_LINE_ID)) {
+    return ERR_PTR(-EINVAL);
+  }
+
+  dev_data = gpio_nl_line(nla_get_u32(tb[BONE_GPIO_ATTR_LINE_ID]));
+  if (!dev_data) {
+    NL_SET_ERR_MSG_ATTR(extack, tb[BONE_GPIO_ATTR_LINE_ID], "No such line");
+    return ERR_PTR(-ENODEV);
+  }
+
+  return dev_data;
+}
+
+static int gpio_nl_apply(struct gpiodev_private_data* dev_data, struct nlattr** tb)
+{
+  int value = tb[BONE_GPIO_ATTR_VALUE] ? nla_get_u8(tb[BONE_GPIO_ATTR_VALUE]) : 0;
+  int ret = 0;
+
+  mutex_lock(&dev_data->pcd_lock);
+
+  if (tb[BONE_GPIO_ATTR_DIRECTION]) {
+    if (nla_get_u8(tb[BONE_GPIO_ATTR_DIRECTION]) == BONE_GPIO_DIR_OUT) {
+      ret = gpiod_direction_output(dev_data->desc, value);
+    } else {
+      ret = gpiod_direction_input(dev_data->desc);
+    }
+  } else if (tb[BONE_GPIO_ATTR_VALUE]) {
+    gpiod_set_value_cansleep(dev_data->desc, value);
+  }
+
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret;
+}
+
+static int gpio_nl_set_doit(struct sk_buff* skb, struct genl_info* info)
+{
+  struct nlattr* tb[BONE_GPIO_ATTR_MAX + 1];
+  struct gpiodev_private_data* dev_data;
+  const struct nlattr* nla;
+  int ret = 0;
+  int rem;
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  // First pass only validates, so a bad entry anywhere leaves every line as it was
+  nlmsg_for_each_attr(nla, info->nlhdr, GENL_HDRLEN, rem) {
+    if (nla_type(nla) != BONE_GPIO_ATTR_LINE) {
+      continue;
+    }
+    dev_data = gpio_nl_parse_line(nla, tb, info->extack);
+    if (IS_ERR(dev_data)) {
+      ret = PTR_ERR(dev_data);
+      goto unlock;
+    }
+    // Unlocked, a PWM started concurrently takes the line over from its next edge
+    if (READ_ONCE(dev_data->pwm_period_ns)) {
+      NL_SET_ERR_MSG_ATTR(info->extack, nla, "Line is a PWM output");
+      ret = -EBUSY;
+      goto unlock;
+    }
+  }
+
+  nlmsg_for_each_attr(nla, info->nlhdr, GENL_HDRLEN, rem) {
+    if (nla_type(nla) != BONE_GPIO_ATTR_LINE) {
+      continue;
+    }
+    dev_data = gpio_nl_parse_line(nla, tb, info->extack);
+
+    ret = gpio_nl_apply(dev_data, tb);
+    if (ret) {
+      NL_SET_ERR_MSG_ATTR(info->extack, nla, "Setting line failed");
+      goto unlock;
+    }
+
+    gpio_netlink_notify(dev_data);
+  }
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return ret;
+}
+
+// Multicasts the current state of a line after it changed
+void gpio_netlink_notify(struct gpiodev_private_data* dev_data)
+{
+  struct sk_buff* msg;
+
+  if (!genl_has_listeners(&gpio_nl_family, &init_net, BONE_GPIO_NL_MCGRP_EVENTS)) {
+    return;
+  }
+
+  msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+  if (!msg) {
+    return;
+  }
+
+  if (gpio_nl_fill(msg, dev_data, 0, 0, 0, BONE_GPIO_CMD_CHANGED)) {
+    nlmsg_free(msg);
+    return;
+  }
+
+  genlmsg_multicast(&gpio_nl_family, msg, 0, BONE_GPIO_NL_MCGRP_EVENTS, GFP_KERNEL);
+}
+
+int gpio_netlink_init(void)
+{
+  return genl_register_family(&gpio_nl_family);
+}
+
+void gpio_netlink_exit(void)
+{
+  genl_unregister_family(&gpio_nl_family);
+}
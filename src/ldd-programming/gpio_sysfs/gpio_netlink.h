@@ -0,0 +1,41 @@
+#ifndef GPIO_NETLINK_H
+#define GPIO_NETLINK_H
+
+// Generic netlink interface of the bone gpio sysfs driver, shared with user space.
+//
+// BONE_GPIO_CMD_GET with NLM_F_DUMP returns one message per line, or just the line
+// given by BONE_GPIO_ATTR_LINE_ID. BONE_GPIO_CMD_SET (CAP_NET_ADMIN) takes any number
+// of BONE_GPIO_ATTR_LINE nests, each holding BONE_GPIO_ATTR_LINE_ID plus
+// BONE_GPIO_ATTR_DIRECTION and/or BONE_GPIO_ATTR_VALUE. A line switched to output
+// starts at the given value, or 0. Every change, through netlink or sysfs, is
+// multicast to the "events" group as BONE_GPIO_CMD_CHANGED.
+
+#define BONE_GPIO_GENL_NAME "bone_gpio"
+#define BONE_GPIO_GENL_VERSION 1
+#define BONE_GPIO_GENL_MCGRP_EVENTS "events"
+
+// Same encoding as GPIO_DIR_IN/GPIO_DIR_OUT in gpio.h
+#define BONE_GPIO_DIR_IN 0
+#define BONE_GPIO_DIR_OUT 1
+
+enum bone_gpio_cmd {
+  BONE_GPIO_CMD_UNSPEC,
+  BONE_GPIO_CMD_GET,
+  BONE_GPIO_CMD_SET,
+  BONE_GPIO_CMD_CHANGED,
+  __BONE_GPIO_CMD_MAX,
+};
+#define BONE_GPIO_CMD_MAX (__BONE_GPIO_CMD_MAX - 1)
+
+enum bone_gpio_attr {
+  BONE_GPIO_ATTR_UNSPEC,
+  BONE_GPIO_ATTR_LINE,      // nested, BONE_GPIO_CMD_SET only
+  BONE_GPIO_ATTR_LINE_ID,   // u32, index of the line under bone_gpio_devs
+  BONE_GPIO_ATTR_LABEL,     // string
+  BONE_GPIO_ATTR_DIRECTION, // u8, BONE_GPIO_DIR_*
+  BONE_GPIO_ATTR_VALUE,     // u8, logical value (0 or 1)
+  __BONE_GPIO_ATTR_MAX,
+};
+#define BONE_GPIO_ATTR_MAX (__BONE_GPIO_ATTR_MAX - 1)
+
+#endif // GPIO_NETLINK_H
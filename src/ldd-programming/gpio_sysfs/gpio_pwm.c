@@ -0,0 +1,228 @@
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include "gpio_sysfs.h"
+
+// Software PWM. Lines with the same period share a group and one hrtimer: every
+// period starts by driving all of them active at once, then the timer stops at
+// each distinct duty in turn to drive the lines that reached it inactive. A group
+// costs one expiry per distinct duty per period, however many lines it has, and
+// each expiry is a single gpiod_set_array_value() for all the lines switching.
+
+#define GPIO_PWM_MAX_CHANNELS 64
+
+static unsigned int pwm_min_period_ns = 100000;
+module_param(pwm_min_period_ns, uint, 0644);
+MODULE_PARM_DESC(pwm_min_period_ns, "Shortest software PWM period accepted, in ns");
+
+struct gpio_pwm_group {
+  struct list_head node; // On gpio_pwm_groups
+  u64 period_ns;
+  struct hrtimer timer;
+  spinlock_t lock; // Channels and their duties against the timer
+  struct list_head channels;
+  unsigned int nr_channels;
+  ktime_t period_start;
+  u64 offset_ns; // Of the current expiry into the period
+  // Scratch space of the timer callback, under lock
+  struct gpio_desc* descs[GPIO_PWM_MAX_CHANNELS];
+  DECLARE_BITMAP(vals, GPIO_PWM_MAX_CHANNELS);
+};
+
+static LIST_HEAD(gpio_pwm_groups);
+static DEFINE_MUTEX(gpio_pwm_lock); // Protects the group list and membership
+
+static enum hrtimer_restart gpio_pwm_timer(struct hrtimer* timer)
+{
+  struct gpio_pwm_group* group = container_of(timer, struct gpio_pwm_group, timer);
+  struct gpiodev_private_data* dev_data;
+  u64 next_ns = group->period_ns;
+  unsigned int nr = 0;
+  ktime_t now;
+
+  spin_lock(&group->lock);
+
+  list_for_each_entry(dev_data, &group->channels, pwm_node) {
+    if (!group->offset_ns) {
+      // Period start: every line goes active, except the ones at 0% duty
+      group->descs[nr] = dev_data->desc;
+      __assign_bit(nr, group->vals, dev_data->pwm_duty_ns != 0);
+      nr++;
+    } else if (dev_data->pwm_duty_ns == group->offset_ns) {
+      group->descs[nr] = dev_data->desc;
+      __clear_bit(nr, group->vals);
+      nr++;
+    }
+
+    // The nearest duty still ahead in this period, 100% duty never switches
+    if (dev_data->pwm_duty_ns > group->offset_ns && dev_data->pwm_duty_ns < next_ns) {
+      next_ns = dev_data->pwm_duty_ns;
+    }
+  }
+
+  if (nr) {
+    gpiod_set_array_value(nr, group->descs, NULL, group->vals);
+  }
+
+  if (next_ns == group->period_ns) {
+    group->period_start = ktime_add_ns(group->period_start, group->period_ns);
+    group->offset_ns = 0;
+
+    // Fell more than a period behind (long irq off section): restart from now
+    // rather than replaying every missed period back to back
+    now = hrtimer_cb_get_time(timer);
+    if (ktime_before(group->period_start, now)) {
+      group->period_start = now;
+    }
+  } else {
+    group->offset_ns = next_ns;
+  }
+
+  hrtimer_set_expires(timer, ktime_add_ns(group->period_start, group->offset_ns));
+
+  spin_unlock(&group->lock);
+
+  return HRTIMER_RESTART;
+}
+
+static struct gpio_pwm_group* gpio_pwm_group_get(u64 period_ns)
+{
+  struct gpio_pwm_group* group;
+
+  list_for_each_entry(group, &gpio_pwm_groups, node) {
+    if (group->period_ns == period_ns) {
+      return group;
+    }
+  }
+
+  group = kzalloc(sizeof(*group), GFP_KERNEL);
+  if (!group) {
+    return NULL;
+  }
+
+  group->period_ns = period_ns;
+  spin_lock_init(&group->lock);
+  INIT_LIST_HEAD(&group->channels);
+  hrtimer_init(&group->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+  group->timer.function = gpio_pwm_timer;
+  list_add(&group->node, &gpio_pwm_groups);
+
+  return group;
+}
+
+// With gpio_pwm_lock held
+static void gpio_pwm_leave(struct gpiodev_private_data* dev_data)
+{
+  struct gpio_pwm_group* group = dev_data->pwm_group;
+  unsigned long flags;
+
+  if (!group) {
+    return;
+  }
+
+  spin_lock_irqsave(&group->lock, flags);
+  list_del(&dev_data->pwm_node);
+  group->nr_channels--;
+  spin_unlock_irqrestore(&group->lock, flags);
+
+  dev_data->pwm_group = NULL;
+
+  if (!group->nr_channels) {
+    hrtimer_cancel(&group->timer);
+    list_del(&group->node);
+    kfree(group);
+  }
+}
+
+// With gpio_pwm_lock held
+static int gpio_pwm_join(struct gpiodev_private_data* dev_data, u64 period_ns)
+{
+  struct gpio_pwm_group* group;
+  unsigned long flags;
+
+  group = gpio_pwm_group_get(period_ns);
+  if (!group) {
+    return -ENOMEM;
+  }
+
+  if (group->nr_channels == GPIO_PWM_MAX_CHANNELS) {
+    return -ENOSPC;
+  }
+
+  spin_lock_irqsave(&group->lock, flags);
+  list_add_tail(&dev_data->pwm_node, &group->channels);
+  group->nr_channels++;
+  spin_unlock_irqrestore(&group->lock, flags);
+
+  dev_data->pwm_group = group;
+
+  // First channel: start the first period right away
+  if (group->nr_channels == 1) {
+    group->period_start = ktime_get();
+    group->offset_ns = 0;
+    hrtimer_start(&group->timer, group->period_start, HRTIMER_MODE_ABS);
+  }
+
+  return 0;
+}
+
+// Sets the period and duty of a line, with pcd_lock held. A period of 0 stops the
+// PWM and leaves the line where it is. A line joining a group that is already
+// running picks up its phase from the group's next period start.
+int gpio_pwm_config(struct gpiodev_private_data* dev_data, u64 period_ns, u64 duty_ns)
+{
+  struct gpio_pwm_group* group;
+  unsigned long flags;
+  int ret = 0;
+
+  if (duty_ns > period_ns && period_ns) {
+    return -EINVAL;
+  }
+
+  if (period_ns && period_ns < pwm_min_period_ns) {
+    return -ERANGE;
+  }
+
+  // Driven from the timer callback, in interrupt context
+  if (period_ns && (gpiod_cansleep(dev_data->desc) || gpiod_get_direction(dev_data->desc) != 0)) {
+    return -EOPNOTSUPP;
+  }
+
+  mutex_lock(&gpio_pwm_lock);
+
+  group = dev_data->pwm_group;
+  if (group && group->period_ns == period_ns) {
+    spin_lock_irqsave(&group->lock, flags);
+    dev_data->pwm_duty_ns = duty_ns;
+    spin_unlock_irqrestore(&group->lock, flags);
+    goto out;
+  }
+
+  gpio_pwm_leave(dev_data);
+  WRITE_ONCE(dev_data->pwm_period_ns, 0);
+  dev_data->pwm_duty_ns = duty_ns;
+
+  if (period_ns) {
+    ret = gpio_pwm_join(dev_data, period_ns);
+    if (ret) {
+      goto unlock;
+    }
+  }
+
+out:
+  WRITE_ONCE(dev_data->pwm_period_ns, period_ns);
+unlock:
+  mutex_unlock(&gpio_pwm_lock);
+
+  return ret;
+}
+
+void gpio_pwm_release(struct gpiodev_private_data* dev_data)
+{
+  mutex_lock(&gpio_pwm_lock);
+  gpio_pwm_leave(dev_data);
+  WRITE_ONCE(dev_data->pwm_period_ns, 0);
+  mutex_unlock(&gpio_pwm_lock);
+}
@@ -0,0 +1,244 @@
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/bitmap.h>
+#include <linux/mm.h>
+#include "gpio_sysfs.h"
+
+// Waveform sequencer for the chip device. A sequence of {mask, bits, delay_ns} steps
+// is copied in once and then played back from an hrtimer, so a bit-banged transfer
+// costs one ioctl instead of a few syscalls and a usleep() per edge, and the edges
+// are timed by the kernel rather than by the scheduler.
+
+struct gpio_seq_step {
+  DECLARE_BITMAP(vals, BONE_GPIO_MAX_LINES); // Every line of the sequence, in descs order
+  u64 delay_ns;
+};
+
+struct gpio_seq {
+  struct list_head node; // On gpio_seqs
+  struct hrtimer timer;
+  wait_queue_head_t wait;
+  struct gpio_desc* descs[BONE_GPIO_MAX_LINES];
+  unsigned int nr_descs;
+  struct gpio_seq_step* steps;
+  unsigned int nr_steps;
+  unsigned int pos; // Next step to play
+  int error;
+  bool running;
+};
+
+// Sequences of all open chip files. This list and the sequences themselves are
+// protected by gpio_drv_data.lock, which also keeps the lines from going away.
+static LIST_HEAD(gpio_seqs);
+
+static enum hrtimer_restart gpio_seq_timer(struct hrtimer* timer)
+{
+  struct gpio_seq* seq = container_of(timer, struct gpio_seq, timer);
+  struct gpio_seq_step* step;
+  int ret;
+
+  // Steps without a delay go out back to back from the same expiry
+  while (seq->pos < seq->nr_steps) {
+    step = &seq->steps[seq->pos++];
+
+    ret = gpiod_set_array_value(seq->nr_descs, seq->descs, NULL, step->vals);
+    if (ret) {
+      seq->error = ret;
+      break;
+    }
+
+    if (step->delay_ns) {
+      // Relative to the previous expiry rather than to now, so the latency of
+      // this callback doesn't add up over the sequence
+      hrtimer_add_expires_ns(timer, step->delay_ns);
+      return HRTIMER_RESTART;
+    }
+  }
+
+  WRITE_ONCE(seq->running, false);
+  wake_up_interruptible(&seq->wait);
+
+  return HRTIMER_NORESTART;
+}
+
+struct gpio_seq* gpio_seq_alloc(void)
+{
+  struct gpio_seq* seq;
+
+  seq = kzalloc(sizeof(*seq), GFP_KERNEL);
+  if (!seq) {
+    return NULL;
+  }
+
+  hrtimer_init(&seq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  seq->timer.function = gpio_seq_timer;
+  init_waitqueue_head(&seq->wait);
+
+  mutex_lock(&gpio_drv_data.lock);
+  list_add(&seq->node, &gpio_seqs);
+  mutex_unlock(&gpio_drv_data.lock);
+
+  return seq;
+}
+
+void gpio_seq_free(struct gpio_seq* seq)
+{
+  mutex_lock(&gpio_drv_data.lock);
+  gpio_seq_stop(seq);
+  list_del(&seq->node);
+  mutex_unlock(&gpio_drv_data.lock);
+
+  kvfree(seq->steps);
+  kfree(seq);
+}
+
+// Stops the sequence where it is, with gpio_drv_data.lock held
+void gpio_seq_stop(struct gpio_seq* seq)
+{
+  // Also waits for a callback in progress, so running is stable afterwards
+  hrtimer_cancel(&seq->timer);
+
+  if (seq->running) {
+    seq->error = -ECANCELED;
+    WRITE_ONCE(seq->running, false);
+    wake_up_interruptible(&seq->wait);
+  }
+}
+
+// With gpio_drv_data.lock held, before the lines are destroyed
+void gpio_seq_stop_all(void)
+{
+  struct gpio_seq* seq;
+
+  list_for_each_entry(seq, &gpio_seqs, node) {
+    gpio_seq_stop(seq);
+  }
+}
+
+long gpio_seq_start(struct gpio_seq* seq, struct bone_gpio_seq __user* uarg)
+{
+  DECLARE_BITMAP(cur, BONE_GPIO_MAX_LINES);
+  struct bone_gpio_seq_step* usteps;
+  struct gpio_seq_step* steps;
+  struct gpio_seq_step* old;
+  struct gpio_chip_lines lines;
+  struct bone_gpio_seq arg;
+  u64 mask = 0;
+  unsigned int i;
+  unsigned int j;
+  long ret;
+
+  if (copy_from_user(&arg, uarg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
+  if ((arg.flags & ~BONE_GPIO_SEQ_WAIT) || !arg.nr_steps || arg.nr_steps > BONE_GPIO_SEQ_MAX_STEPS) {
+    return -EINVAL;
+  }
+
+  usteps = vmemdup_user(u64_to_user_ptr(arg.steps), array_size(arg.nr_steps, sizeof(*usteps)));
+  if (IS_ERR(usteps)) {
+    return PTR_ERR(usteps);
+  }
+
+  steps = kvcalloc(arg.nr_steps, sizeof(*steps), GFP_KERNEL);
+  if (!steps) {
+    ret = -ENOMEM;
+    goto free_usteps;
+  }
+
+  for (i = 0; i < arg.nr_steps; i++) {
+    mask |= usteps[i].mask;
+  }
+
+  mutex_lock(&gpio_drv_data.lock);
+
+  if (seq->running) {
+    ret = -EBUSY;
+    goto unlock;
+  }
+
+  ret = gpio_chip_collect(mask, &lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  if (!lines.nr) {
+    ret = -EINVAL;
+    goto unlock;
+  }
+
+  ret = gpio_chip_check_pwm(&lines);
+  if (ret) {
+    goto unlock;
+  }
+
+  // The timer callback runs in interrupt context, which rules out lines behind
+  // i2c or spi expanders
+  for (i = 0; i < lines.nr; i++) {
+    if (gpiod_cansleep(lines.descs[i])) {
+      ret = -EOPNOTSUPP;
+      goto unlock;
+    }
+  }
+
+  // Every step drives all the lines of the sequence, the ones outside its mask
+  // from a running image that starts at their current values
+  ret = gpiod_get_array_value(lines.nr, lines.descs, NULL, cur);
+  if (ret) {
+    goto unlock;
+  }
+
+  for (i = 0; i < arg.nr_steps; i++) {
+    for (j = 0; j < lines.nr; j++) {
+      if (usteps[i].mask & BIT_ULL(lines.ids[j])) {
+        __assign_bit(j, cur, usteps[i].bits & BIT_ULL(lines.ids[j]));
+      }
+    }
+    bitmap_copy(steps[i].vals, cur, BONE_GPIO_MAX_LINES);
+    steps[i].delay_ns = usteps[i].delay_ns;
+  }
+
+  // A finished sequence may still be returning from its callback
+  hrtimer_cancel(&seq->timer);
+
+  old = seq->steps;
+  seq->steps = steps;
+  steps = old;
+
+  memcpy(seq->descs, lines.descs, sizeof(lines.descs));
+  seq->nr_descs = lines.nr;
+  seq->nr_steps = arg.nr_steps;
+  seq->pos = 0;
+  seq->error = 0;
+  WRITE_ONCE(seq->running, true);
+
+  hrtimer_start(&seq->timer, 0, HRTIMER_MODE_REL);
+
+unlock:
+  mutex_unlock(&gpio_drv_data.lock);
+  kvfree(steps);
+free_usteps:
+  kvfree(usteps);
+
+  if (ret || !(arg.flags & BONE_GPIO_SEQ_WAIT)) {
+    return ret;
+  }
+
+  // Interrupted waits leave the sequence running, BONE_GPIO_IOC_SEQ_STOP aborts it
+  ret = wait_event_interruptible(seq->wait, !READ_ONCE(seq->running));
+  if (ret) {
+    return ret;
+  }
+
+  return READ_ONCE(seq->error);
+}
+
+__poll_t gpio_seq_poll(struct gpio_seq* seq, struct file* filp, poll_table* wait)
+{
+  poll_wait(filp, &seq->wait, wait);
+
+  return READ_ONCE(seq->running) ? 0 : EPOLLOUT | EPOLLWRNORM;
+}
@@ -1,39 +1,18 @@
-#include <linux/module.h>
-#include <linux/fs.h>
-#include <linux/cdev.h>
-#include <linux/device.h>
-#include <linux/kdev_t.h>
-#include <linux/uaccess.h>
-#include <linux/platform_device.h>
-#include <linux/slab.h>
-#include <linux/mod_devicetable.h>
-#include <linux/of.h>
-#include <linux/of_device.h>
-#include <linux/gpio/consumer.h>
-#include <linux/string.h>
+#include "gpio_sysfs.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("udemy ldd programming");
 MODULE_DESCRIPTION("gpio sysfs driver");
 MODULE_VERSION("1.0");
 
-// Format every pr_* message with the current running function name
-#undef pr_fmt
-#define pr_fmt(fmt) "%s : " fmt,__func__
-
-static struct gpiodev_private_data {
-  char label[20];
-  struct gpio_desc* desc;
-  struct mutex pcd_lock;
-};
-
-static struct gpiodrv_private_data {
-  int total_devices;
-  struct class* class_gpio;
-  struct device** dev;
+struct gpiodrv_private_data gpio_drv_data = {
+  .lock = __MUTEX_INITIALIZER(gpio_drv_data.lock),
+  .event_wait = __WAIT_QUEUE_HEAD_INITIALIZER(gpio_drv_data.event_wait),
 };
 
-struct gpiodrv_private_data gpio_drv_data;
+static bool compact_layout;
+module_param(compact_layout, bool, 0444);
+MODULE_PARM_DESC(compact_layout, "One chip device with array attributes instead of a device per line");
 
 struct of_device_id gpio_device_match[] = {
   { .compatible = "org,bone-gpio-sysfs" },
@@ -69,6 +48,12 @@ ssize_t direction_store(struct device* dev, struct device_attribute* attr, const
 
   mutex_lock(&dev_data->pcd_lock);
 
+  // The line belongs to its PWM until period_ns goes back to 0
+  if (dev_data->pwm_period_ns) {
+    mutex_unlock(&dev_data->pcd_lock);
+    return -EBUSY;
+  }
+
   if (sysfs_streq(buf, "in")) {
     ret = gpiod_direction_input(dev_data->desc);
   } else if (sysfs_streq(buf, "out")) {
@@ -79,22 +64,39 @@ ssize_t direction_store(struct device* dev, struct device_attribute* attr, const
 
   mutex_unlock(&dev_data->pcd_lock);
 
-  return ret ? ret : count;
+  if (ret) {
+    return ret;
+  }
+
+  gpio_netlink_notify(dev_data);
+
+  return count;
 }
 
+// The value path takes no lock for lines that don't sleep: gpiolib serialises
+// access to the controller itself, and pcd_lock only has to keep direction,
+// edge and the other modes consistent with each other.
 ssize_t value_show(struct device* dev, struct device_attribute* attr, char* buf)
 {
   struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
   int value;
-  
-  mutex_lock(&dev_data->pcd_lock);
 
-  value = gpiod_get_value(dev_data->desc);
-  ssize_t written = sprintf(buf, "%d\n", value);
+  // With a software debounce, only what made it through the filter
+  if (READ_ONCE(dev_data->sw_debounce)) {
+    value = READ_ONCE(dev_data->stable_value);
+  } else if (!dev_data->cansleep) {
+    value = gpiod_get_value(dev_data->desc);
+  } else {
+    mutex_lock(&dev_data->pcd_lock);
+    value = gpiod_get_value_cansleep(dev_data->desc);
+    mutex_unlock(&dev_data->pcd_lock);
+  }
 
-  mutex_unlock(&dev_data->pcd_lock);
+  if (value < 0) {
+    return value;
+  }
 
-  return written;
+  return sprintf(buf, "%d\n", value);
 }
 
 ssize_t value_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
@@ -103,15 +105,25 @@ ssize_t value_store(struct device* dev, struct device_attribute* attr, const cha
   int ret;
   long value;
 
-  mutex_lock(&dev_data->pcd_lock);
-
   ret = kstrtol(buf, 0, &value);
   if (ret) {
     return ret;
   }
-  gpiod_set_value(dev_data->desc, value);
 
-  mutex_unlock(&dev_data->pcd_lock);
+  // Unlocked, a PWM started concurrently takes the line over from its next edge
+  if (READ_ONCE(dev_data->pwm_period_ns)) {
+    return -EBUSY;
+  }
+
+  if (!dev_data->cansleep) {
+    gpiod_set_value(dev_data->desc, value);
+  } else {
+    mutex_lock(&dev_data->pcd_lock);
+    gpiod_set_value_cansleep(dev_data->desc, value);
+    mutex_unlock(&dev_data->pcd_lock);
+  }
+
+  gpio_netlink_notify(dev_data);
 
   return count;
 }
@@ -127,14 +139,233 @@ ssize_t label_show(struct device* dev, struct device_attribute* attr, char* buf)
   return written;
 }
 
+ssize_t edge_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  char* edge;
+
+  mutex_lock(&dev_data->pcd_lock);
+
+  switch (dev_data->edge) {
+    case IRQF_TRIGGER_RISING:
+      edge = "rising";
+      break;
+    case IRQF_TRIGGER_FALLING:
+      edge = "falling";
+      break;
+    case IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING:
+      edge = "both";
+      break;
+    default:
+      edge = "none";
+      break;
+  }
+
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return sprintf(buf, "%s\n", edge);
+}
+
+ssize_t edge_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  unsigned long edge;
+  int ret;
+
+  if (sysfs_streq(buf, "none")) {
+    edge = 0;
+  } else if (sysfs_streq(buf, "rising")) {
+    edge = IRQF_TRIGGER_RISING;
+  } else if (sysfs_streq(buf, "falling")) {
+    edge = IRQF_TRIGGER_FALLING;
+  } else if (sysfs_streq(buf, "both")) {
+    edge = IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING;
+  } else {
+    return -EINVAL;
+  }
+
+  // Edges are reported on the chip device and by poll() on value
+  mutex_lock(&dev_data->pcd_lock);
+  ret = gpio_event_set_edge(dev_data, dev, edge);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret ? ret : count;
+}
+
+ssize_t debounce_us_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  unsigned int debounce_us;
+
+  mutex_lock(&dev_data->pcd_lock);
+  debounce_us = dev_data->debounce_us;
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return sprintf(buf, "%u\n", debounce_us);
+}
+
+ssize_t debounce_us_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  unsigned int debounce_us;
+  int ret;
+
+  ret = kstrtouint(buf, 0, &debounce_us);
+  if (ret) {
+    return ret;
+  }
+
+  mutex_lock(&dev_data->pcd_lock);
+  ret = gpio_event_set_debounce(dev_data, dev, debounce_us);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret ? ret : count;
+}
+
+ssize_t period_ns_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  u64 period_ns;
+
+  mutex_lock(&dev_data->pcd_lock);
+  period_ns = dev_data->pwm_period_ns;
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return sprintf(buf, "%llu\n", period_ns);
+}
+
+ssize_t period_ns_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  u64 period_ns;
+  int ret;
+
+  ret = kstrtou64(buf, 0, &period_ns);
+  if (ret) {
+    return ret;
+  }
+
+  // A non zero period turns the output into a software PWM, 0 turns it back
+  mutex_lock(&dev_data->pcd_lock);
+  ret = gpio_pwm_config(dev_data, period_ns, dev_data->pwm_duty_ns);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret ? ret : count;
+}
+
+ssize_t duty_ns_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  u64 duty_ns;
+
+  mutex_lock(&dev_data->pcd_lock);
+  duty_ns = dev_data->pwm_duty_ns;
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return sprintf(buf, "%llu\n", duty_ns);
+}
+
+ssize_t duty_ns_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  u64 duty_ns;
+  int ret;
+
+  ret = kstrtou64(buf, 0, &duty_ns);
+  if (ret) {
+    return ret;
+  }
+
+  mutex_lock(&dev_data->pcd_lock);
+  ret = gpio_pwm_config(dev_data, dev_data->pwm_period_ns, duty_ns);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret ? ret : count;
+}
+
+ssize_t counter_window_ms_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  u64 window_ns;
+
+  mutex_lock(&dev_data->pcd_lock);
+  window_ns = dev_data->counter.window_ns;
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return sprintf(buf, "%llu\n", div_u64(window_ns, NSEC_PER_MSEC));
+}
+
+ssize_t counter_window_ms_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
+{
+  struct gpiodev_private_data* dev_data = dev_get_drvdata(dev);
+  unsigned int window_ms;
+  int ret;
+
+  ret = kstrtouint(buf, 0, &window_ms);
+  if (ret) {
+    return ret;
+  }
+
+  // A non zero window puts the input in counter mode, 0 takes it out
+  mutex_lock(&dev_data->pcd_lock);
+  ret = gpio_counter_set_window(dev_data, dev, (u64)window_ms * NSEC_PER_MSEC);
+  mutex_unlock(&dev_data->pcd_lock);
+
+  return ret ? ret : count;
+}
+
+// Results of the last complete counter window
+ssize_t frequency_millihz_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct bone_gpio_measurement result;
+
+  gpio_counter_read(dev_get_drvdata(dev), &result);
+
+  return sprintf(buf, "%llu\n", result.frequency_millihz);
+}
+
+ssize_t pulse_high_ns_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct bone_gpio_measurement result;
+
+  gpio_counter_read(dev_get_drvdata(dev), &result);
+
+  return sprintf(buf, "%llu\n", result.high_ns);
+}
+
+ssize_t pulse_low_ns_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct bone_gpio_measurement result;
+
+  gpio_counter_read(dev_get_drvdata(dev), &result);
+
+  return sprintf(buf, "%llu\n", result.low_ns);
+}
+
 static DEVICE_ATTR_RW(direction);
 static DEVICE_ATTR_RW(value);
 static DEVICE_ATTR_RO(label);
+static DEVICE_ATTR_RW(edge);
+static DEVICE_ATTR_RW(debounce_us);
+static DEVICE_ATTR_RW(period_ns);
+static DEVICE_ATTR_RW(duty_ns);
+static DEVICE_ATTR_RW(counter_window_ms);
+static DEVICE_ATTR_RO(frequency_millihz);
+static DEVICE_ATTR_RO(pulse_high_ns);
+static DEVICE_ATTR_RO(pulse_low_ns);
 
 static struct attribute* gpio_attrs[] = {
   &dev_attr_direction.attr,
   &dev_attr_value.attr,
   &dev_attr_label.attr,
+  &dev_attr_edge.attr,
+  &dev_attr_debounce_us.attr,
+  &dev_attr_period_ns.attr,
+  &dev_attr_duty_ns.attr,
+  &dev_attr_counter_window_ms.attr,
+  &dev_attr_frequency_millihz.attr,
+  &dev_attr_pulse_high_ns.attr,
+  &dev_attr_pulse_low_ns.attr,
   NULL,
 };
 
@@ -147,79 +378,163 @@ static const struct attribute_group* gpio_attr_groups[] = {
   NULL,
 };
 
+// The line's device goes first: unregistering it waits for stores in progress, so
+// none of them can request the irq or arm a timer again once they are released.
+// pcd_lock covers the compact layout, whose lines have no device of their own.
+static void gpio_sysfs_destroy_lines(struct gpiodev_private_data** lines, int nr_lines)
+{
+  struct gpiodev_private_data* dev_data;
+
+  while (nr_lines--) {
+    dev_data = lines[nr_lines];
+
+    if (dev_data->dev) {
+      device_unregister(dev_data->dev);
+      dev_data->dev = NULL;
+    }
+
+    mutex_lock(&dev_data->pcd_lock);
+    gpio_pwm_release(dev_data);
+    gpio_counter_release(dev_data);
+    gpio_event_release(dev_data);
+    mutex_unlock(&dev_data->pcd_lock);
+  }
+}
+
 static int gpio_sysfs_probe(struct platform_device* pdev)
 {
   int ret;
   struct device* dev = &pdev->dev;
-  struct device_node* parent = pdev->dev.of_node;
-  struct device_node* child = NULL;
+  struct fwnode_handle* child = NULL;
   struct gpiodev_private_data* dev_data;
+  struct gpiodev_private_data** lines;
   const char* name;
+  ktime_t start = ktime_get();
+  int total_devices;
   int i = 0;
 
-  gpio_drv_data.total_devices = of_get_child_count(parent);
-  if (!gpio_drv_data.total_devices) {
+  // Walked as firmware nodes rather than DT nodes, so the driver can also be bound
+  // through software nodes, e.g. over gpio-sim lines on a PC
+  total_devices = device_get_child_node_count(dev);
+  if (!total_devices) {
     dev_err(dev, "No devices found\n");
     return -EINVAL;
   }
 
-  dev_info(dev, "Total devices == %d\n", gpio_drv_data.total_devices);
+  dev_info(dev, "Total devices == %d\n", total_devices);
 
-  gpio_drv_data.dev = devm_kzalloc(dev, sizeof(struct device*) * gpio_drv_data.total_devices, GFP_KERNEL);
+  lines = devm_kcalloc(dev, total_devices, sizeof(*lines), GFP_KERNEL);
+  if (!lines) {
+    return -ENOMEM;
+  }
+
+  device_for_each_child_node(dev, child) {
+    // Bus nodes group several lines behind a device of their own, they are not lines
+    if (fwnode_property_present(child, "data-gpios")) {
+      ret = gpio_bus_create(dev, child);
+      if (ret) {
+        goto put_child;
+      }
+      continue;
+    }
 
-  for_each_available_child_of_node(parent, child) {
     dev_data = devm_kzalloc(dev, sizeof(*dev_data), GFP_KERNEL);
     if (!dev_data) {
       dev_err(dev, "Cannot allocate memory\n");
-      return -ENOMEM;
+      ret = -ENOMEM;
+      goto put_child;
     }
 
     mutex_init(&dev_data->pcd_lock);
+    gpio_event_init(dev_data);
+    gpio_counter_init(dev_data);
+    dev_data->id = i;
 
-    if (of_property_read_string(child, "label", &name)) {
+    if (fwnode_property_read_string(child, "label", &name)) {
       dev_warn(dev, "Missing label information\n");
       snprintf(dev_data->label, sizeof(dev_data->label), "unkngpio%d", i);
     } else {
-      strcpy(dev_data->label, name);
-      dev_info(dev, "GPIO label = %s\n", dev_data->label);
+      strscpy(dev_data->label, name, sizeof(dev_data->label));
+      dev_dbg(dev, "GPIO label = %s\n", dev_data->label);
     }
 
-    dev_data->desc = devm_fwnode_get_gpiod_from_child(dev, "bone", &child->fwnode, GPIOD_ASIS, dev_data->label);
+    dev_data->desc = devm_fwnode_gpiod_get(dev, child, "bone", GPIOD_ASIS, dev_data->label);
     if (IS_ERR(dev_data->desc)) {
       ret = PTR_ERR(dev_data->desc);
       if (ret == -ENOENT) {
         dev_err(dev, "No gpio has been assigned to the requested function and/or index\n");
       }
-      return ret;
+      goto put_child;
     }
 
+    dev_data->cansleep = gpiod_cansleep(dev_data->desc);
+
     // Takes into account ACTIVE_LOW/HIGH, so writing 1 to this func will always set
     // the gpio to "active" regardless of whether it's active when it's high or low.
     ret = gpiod_direction_output(dev_data->desc, 0);
     if (ret) {
       dev_err(dev, "gpio direction set failed\n");
-      return ret;
+      goto put_child;
     }
 
-    gpio_drv_data.dev[i] = device_create_with_groups(gpio_drv_data.class_gpio, dev, 0, dev_data, gpio_attr_groups, dev_data->label);
-    if (IS_ERR(gpio_drv_data.dev[i])) {
-      dev_err(dev, "Error during device_create\n");
-      return PTR_ERR(gpio_drv_data.dev[i]);
+    // The compact layout has no per-line devices, the lines are reached through
+    // the array attributes of the chip device
+    if (!compact_layout) {
+      dev_data->dev = device_create_with_groups(gpio_drv_data.class_gpio, dev, 0, dev_data, gpio_attr_groups, dev_data->label);
+      if (IS_ERR(dev_data->dev)) {
+        dev_err(dev, "Error during device_create\n");
+        ret = PTR_ERR(dev_data->dev);
+        dev_data->dev = NULL;
+        goto put_child;
+      }
     }
 
-    i++;
+    lines[i++] = dev_data;
+  }
+
+  ret = gpio_chip_create(dev, compact_layout ? gpio_compact_groups : NULL);
+  if (ret) {
+    dev_err(dev, "Error creating the chip device\n");
+    goto put_child;
   }
 
+  // Only fully set up lines become visible to netlink and the chip device
+  mutex_lock(&gpio_drv_data.lock);
+  gpio_drv_data.lines = lines;
+  gpio_drv_data.total_devices = i;
+  mutex_unlock(&gpio_drv_data.lock);
+
+  dev_info(dev, "%d lines set up in %lld us (%s layout)\n", i, ktime_us_delta(ktime_get(), start),
+           compact_layout ? "compact" : "per-line");
+
   return 0;
+
+put_child:
+  fwnode_handle_put(child);
+  gpio_bus_destroy_all();
+  gpio_sysfs_destroy_lines(lines, i);
+  return ret;
 }
 
 static int gpio_sysfs_remove(struct platform_device* pdev)
 {
+  int total_devices;
+
   dev_info(&pdev->dev, "Remove called\n");
-  int i;
-  for (i = 0; i < gpio_drv_data.total_devices; i++) {
-    of_device_unregister(gpio_drv_data.dev[i]);
-  }
+
+  mutex_lock(&gpio_drv_data.lock);
+  total_devices = gpio_drv_data.total_devices;
+  gpio_drv_data.total_devices = 0;
+  // Running sequences and captures hold descriptors of the lines about to go away
+  gpio_seq_stop_all();
+  gpio_capture_stop_all();
+  mutex_unlock(&gpio_drv_data.lock);
+
+  gpio_chip_destroy();
+  gpio_bus_destroy_all();
+
+  gpio_sysfs_destroy_lines(gpio_drv_data.lines, total_devices);
+
   return 0;
 }
 
@@ -234,22 +549,60 @@ const static struct platform_driver gpio_sysfs_platform_driver = {
 
 static int __init gpio_sysfs_init(void)
 {
+  int ret;
+
   gpio_drv_data.class_gpio = class_create(THIS_MODULE, "bone_gpios");
   if (IS_ERR(gpio_drv_data.class_gpio)) {
     pr_err("Error creating class\n");
     return PTR_ERR(gpio_drv_data.class_gpio);
   }
 
-  platform_driver_register(&gpio_sysfs_platform_driver);
+  ret = gpio_chip_init();
+  if (ret) {
+    pr_err("Error allocating the chip device number\n");
+    goto destroy_class;
+  }
+
+  ret = gpio_bus_init();
+  if (ret) {
+    pr_err("Error allocating the bus device numbers\n");
+    goto chip_exit;
+  }
+
+  // Registered before the driver, whose attributes notify the family once bound
+  ret = gpio_netlink_init();
+  if (ret) {
+    pr_err("Error registering generic netlink family\n");
+    goto bus_exit;
+  }
+
+  ret = platform_driver_register(&gpio_sysfs_platform_driver);
+  if (ret) {
+    pr_err("Error registering the platform driver\n");
+    goto netlink_exit;
+  }
 
   pr_info("Module successfully loaded\n");
 
   return 0;
+
+netlink_exit:
+  gpio_netlink_exit();
+bus_exit:
+  gpio_bus_exit();
+chip_exit:
+  gpio_chip_exit();
+destroy_class:
+  class_destroy(gpio_drv_data.class_gpio);
+  return ret;
 }
 
 static void __exit gpio_sysfs_exit(void)
 {
   platform_driver_unregister(&gpio_sysfs_platform_driver);
+  gpio_netlink_exit();
+  gpio_bus_exit();
+  gpio_chip_exit();
   class_destroy(gpio_drv_data.class_gpio);
 }
 
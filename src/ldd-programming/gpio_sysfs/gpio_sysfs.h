@@ -0,0 +1,174 @@
+#ifndef GPIO_SYSFS_H
+#define GPIO_SYSFS_H
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/kdev_t.h>
+#include <linux/uaccess.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/mod_devicetable.h>
+#include <linux/of.h>
+#include <linux/of_device.h>
+#include <linux/property.h>
+#include <linux/gpio/consumer.h>
+#include <linux/string.h>
+#include <linux/poll.h>
+#include <linux/kfifo.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include "bone_gpio_ioctl.h"
+
+// Format every pr_* message with the current running function name
+#undef pr_fmt
+#define pr_fmt(fmt) "%s : " fmt,__func__
+
+// Edge event as queued by the irq handler, the line is filled in when it's read
+struct gpio_event {
+  u64 timestamp_ns;
+  u32 id;
+  u32 seqno;
+};
+
+struct gpio_event_fifo {
+  DECLARE_KFIFO_PTR(fifo, struct gpio_event);
+};
+
+// Counter mode of an input: edges are counted and timed in the irq handler, the
+// window timer turns them into a measurement every window_ns
+struct gpio_counter {
+  spinlock_t lock;
+  struct hrtimer window_timer;
+  u64 window_ns; // 0 when off, under pcd_lock
+  u64 last_edge_ns;
+  u32 edges;
+  u32 rising;
+  u64 high_sum_ns;
+  u32 high_pulses;
+  u64 low_sum_ns;
+  u32 low_pulses;
+  struct bone_gpio_measurement result; // Of the last complete window
+};
+
+static struct gpiodev_private_data {
+  char label[20];
+  struct gpio_desc* desc;
+  struct mutex pcd_lock;
+  bool cansleep; // Behind a controller that sleeps (i2c, spi expanders)
+  int id; // Index of the line under bone_gpio_devs
+  struct device* dev; // Per-line device, NULL in the compact layout
+  unsigned long edge; // IRQF_TRIGGER_* the line reports events for, under pcd_lock
+  int irq;
+  bool irq_requested;
+  unsigned long irq_flags; // Edges the interrupt was requested for
+  unsigned int debounce_us;
+  bool sw_debounce; // Filtered by debounce_timer, the controller can't
+  struct hrtimer debounce_timer;
+  u64 debounce_ts; // Time of the latest edge seen by the filter
+  int stable_value; // Last value that got through the filter
+  u64 pwm_period_ns; // 0 when the line isn't a PWM output, under pcd_lock
+  u64 pwm_duty_ns;
+  struct gpio_pwm_group* pwm_group;
+  struct list_head pwm_node;
+  struct gpio_counter counter;
+  struct gpio_event_fifo* events; // Allocated when edge is first set
+  spinlock_t event_lock; // Serialises producers of events
+  u32 event_seqno;
+  struct kernfs_node* value_kn; // For poll() on the value attribute
+};
+
+static struct gpiodrv_private_data {
+  int total_devices;
+  struct class* class_gpio;
+  struct gpiodev_private_data** lines;
+  struct mutex lock; // Protects total_devices and lines against probe/remove
+  dev_t chip_devt;
+  struct cdev* chip_cdev; // Allocated, it can outlive the bind while a file is open
+  struct device* chip_dev;
+  wait_queue_head_t event_wait; // Woken on every edge event
+  atomic_t event_count;
+};
+
+// State of an open chip device file
+struct gpio_chip_file {
+  struct gpio_seq* seq;
+  struct gpio_capture* capture;
+  u64 watch; // Lines read() returns edge events of
+};
+
+extern struct gpiodrv_private_data gpio_drv_data;
+
+struct gpio_chip_lines {
+  unsigned int nr;
+  struct gpio_desc* descs[BONE_GPIO_MAX_LINES];
+  unsigned int ids[BONE_GPIO_MAX_LINES];
+};
+
+struct gpio_seq;
+struct gpio_capture;
+struct gpio_pwm_group;
+
+// gpio_chip.c
+int gpio_chip_collect(u64 mask, struct gpio_chip_lines* lines);
+int gpio_chip_check_pwm(const struct gpio_chip_lines* lines);
+int gpio_chip_init(void);
+void gpio_chip_exit(void);
+int gpio_chip_create(struct device* parent, const struct attribute_group** groups);
+void gpio_chip_destroy(void);
+
+// gpio_bus.c
+int gpio_bus_init(void);
+void gpio_bus_exit(void);
+int gpio_bus_create(struct device* dev, struct fwnode_handle* child);
+void gpio_bus_destroy_all(void);
+
+// gpio_compact.c
+extern const struct attribute_group* gpio_compact_groups[];
+
+// gpio_seq.c
+struct gpio_seq* gpio_seq_alloc(void);
+void gpio_seq_free(struct gpio_seq* seq);
+long gpio_seq_start(struct gpio_seq* seq, struct bone_gpio_seq __user* uarg);
+void gpio_seq_stop(struct gpio_seq* seq);
+void gpio_seq_stop_all(void);
+__poll_t gpio_seq_poll(struct gpio_seq* seq, struct file* filp, poll_table* wait);
+
+// gpio_capture.c
+struct gpio_capture* gpio_capture_alloc(void);
+void gpio_capture_free(struct gpio_capture* cap);
+long gpio_capture_start(struct gpio_capture* cap, struct bone_gpio_capture __user* uarg);
+void gpio_capture_stop(struct gpio_capture* cap);
+void gpio_capture_stop_all(void);
+int gpio_capture_mmap(struct gpio_capture* cap, struct vm_area_struct* vma);
+
+// gpio_event.c
+void gpio_event_init(struct gpiodev_private_data* dev_data);
+int gpio_event_request_irq(struct gpiodev_private_data* dev_data, struct device* dev);
+void gpio_event_record(struct gpiodev_private_data* dev_data, u64 timestamp_ns, u32 id);
+int gpio_event_set_edge(struct gpiodev_private_data* dev_data, struct device* dev, unsigned long edge);
+int gpio_event_set_debounce(struct gpiodev_private_data* dev_data, struct device* dev, unsigned int debounce_us);
+void gpio_event_release(struct gpiodev_private_data* dev_data);
+ssize_t gpio_event_read(struct gpio_chip_file* cfile, struct file* filp, char __user* buff, size_t count);
+__poll_t gpio_event_poll(struct gpio_chip_file* cfile, struct file* filp, poll_table* wait);
+
+// gpio_counter.c
+void gpio_counter_init(struct gpiodev_private_data* dev_data);
+void gpio_counter_edge(struct gpiodev_private_data* dev_data, u64 timestamp_ns, int value);
+int gpio_counter_set_window(struct gpiodev_private_data* dev_data, struct device* dev, u64 window_ns);
+void gpio_counter_read(struct gpiodev_private_data* dev_data, struct bone_gpio_measurement* result);
+void gpio_counter_release(struct gpiodev_private_data* dev_data);
+long gpio_counter_ioctl_get(struct bone_gpio_measurement __user* uarg);
+
+// gpio_pwm.c
+int gpio_pwm_config(struct gpiodev_private_data* dev_data, u64 period_ns, u64 duty_ns);
+void gpio_pwm_release(struct gpiodev_private_data* dev_data);
+
+// gpio_netlink.c
+int gpio_netlink_init(void);
+void gpio_netlink_exit(void);
+void gpio_netlink_notify(struct gpiodev_private_data* dev_data);
+
+#endif // GPIO_SYSFS_H
@@ -0,0 +1,113 @@
+/*
+ * Toggle rate of a bone_gpios output line, through its sysfs value attribute
+ * (one pwrite per edge on a file kept open) and through the chip device. Run it
+ * against the module before and after a change to the value path.
+ *
+ *   gcc -O2 -o gpio_toggle_bench gpio_toggle_bench.c
+ *   ./gpio_toggle_bench <label> <line> [toggles]
+ *   ./gpio_toggle_bench gpio2.7 0 1000000
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "gpio.h"
+#include "bone_gpio_ioctl.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_sysfs(const char *label, long toggles)
+{
+  char path[SOME_BYTES];
+  double start, elapsed;
+  long i;
+  int fd;
+
+  snprintf(path, sizeof(path), SYS_GPIO_PATH "/%s/value", label);
+
+  fd = open(path, O_WRONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  start = now_sec();
+  for (i = 0; i < toggles; i++) {
+    if (pwrite(fd, (i & 1) ? "0" : "1", 1, 0) != 1) {
+      perror("pwrite");
+      close(fd);
+      return -1;
+    }
+  }
+  elapsed = now_sec() - start;
+
+  printf("sysfs value : %ld toggles in %.3f s, %.0f toggles/s, %.2f us/toggle\n",
+         toggles, elapsed, toggles / elapsed, elapsed * 1e6 / toggles);
+
+  close(fd);
+
+  return 0;
+}
+
+static int bench_chip(unsigned int line, long toggles)
+{
+  struct bone_gpio_values vals = { .mask = 1ULL << line };
+  double start, elapsed;
+  long i;
+  int fd;
+
+  fd = open(BONE_GPIO_CHIP_PATH, O_RDWR);
+  if (fd < 0) {
+    perror(BONE_GPIO_CHIP_PATH);
+    return -1;
+  }
+
+  start = now_sec();
+  for (i = 0; i < toggles; i++) {
+    vals.bits = (i & 1) ? 0 : vals.mask;
+    if (ioctl(fd, BONE_GPIO_IOC_SET_VALUES, &vals) < 0) {
+      perror("BONE_GPIO_IOC_SET_VALUES");
+      close(fd);
+      return -1;
+    }
+  }
+  elapsed = now_sec() - start;
+
+  printf("chip ioctl  : %ld toggles in %.3f s, %.0f toggles/s, %.2f us/toggle\n",
+         toggles, elapsed, toggles / elapsed, elapsed * 1e6 / toggles);
+
+  close(fd);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  long toggles = 100000;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <label> <line> [toggles]\n", argv[0]);
+    return 1;
+  }
+
+  if (argc > 3) {
+    toggles = strtol(argv[3], NULL, 0);
+  }
+
+  if (bench_sysfs(argv[1], toggles) || bench_chip(strtoul(argv[2], NULL, 0), toggles)) {
+    return 1;
+  }
+
+  return 0;
+}
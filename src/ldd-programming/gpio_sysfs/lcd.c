@@ -7,13 +7,30 @@
 
 #include "gpio.h"
 #include "lcd.h"
+#include "bone_gpio_ioctl.h"
 
 static void write_4_bits(uint8_t data);
 
+// Chip device for driving the data lines together, -1 falls back to sysfs
+static int chip_fd = -1;
+
+// Bus device of the lcd bus node, which owns RS, EN and D4..D7 when the DT has it
+static int bus_fd = -1;
+
 void lcd_deinit(void)
 {
 	lcd_display_clear();
 	lcd_display_return_home();
+
+  if (chip_fd >= 0) {
+    gpio_file_close(chip_fd);
+    chip_fd = -1;
+  }
+
+  if (bus_fd >= 0) {
+    gpio_file_close(bus_fd);
+    bus_fd = -1;
+  }
 }
 
 /* 
@@ -24,10 +41,19 @@ void lcd_deinit(void)
  */
 void lcd_init(void)
 {
+  bus_fd = gpio_bus_open(LCD_BUS_LABEL);
+  if (bus_fd < 0) {
+    chip_fd = gpio_chip_open();
+  }
+
   usleep(40 * 1000);
 
   // RS = 0 for LCD command
-  gpio_write_value(GPIO_LCD_RS, LOW_VALUE);
+  if (bus_fd >= 0) {
+    gpio_bus_select(bus_fd, LOW_VALUE);
+  } else {
+    gpio_write_value(GPIO_LCD_RS, LOW_VALUE);
+  }
 
   // R/W = 0 for write
   gpio_write_value(GPIO_LCD_RW, LOW_VALUE);
@@ -98,6 +124,32 @@ void lcd_set_cursor(uint8_t row, uint8_t column)
 // Writes 4 bits of data/cmd to D4, D5, D6, D7 lines
 static void write_4_bits(uint8_t data)
 {
+  // Data lines and EN pulse clocked out by the bus device, which owns them
+  if (bus_fd >= 0) {
+    if (gpio_bus_cycle(bus_fd, data & 0xf)) {
+      perror("lcd bus cycle");
+    }
+    return;
+  }
+
+  // Data lines and the EN pulse of lcd_enable() as one waveform, timed in the kernel
+  struct bone_gpio_seq_step nibble[] = {
+    { LCD_DATA_MASK | LCD_EN_MASK, (uint64_t)(data & 0xf) << LCD_LINE_D4, 1000 },
+    { LCD_EN_MASK, LCD_EN_MASK, 1000 },
+    // Execution time > 37 micro seconds
+    { LCD_EN_MASK, 0, 100000 },
+  };
+
+  if (chip_fd >= 0 && !gpio_play_sequence(chip_fd, nibble, sizeof(nibble) / sizeof(nibble[0]))) {
+    return;
+  }
+
+  // All 4 data lines change together with a single call
+  if (chip_fd >= 0 && !gpio_write_mask(chip_fd, LCD_DATA_MASK, (uint64_t)(data & 0xf) << LCD_LINE_D4)) {
+    lcd_enable();
+    return;
+  }
+
   // 4 bits parallel data write
   gpio_write_value(GPIO_LCD_D4, (data >> 0) & 0x1);
   gpio_write_value(GPIO_LCD_D5, (data >> 1) & 0x1);
@@ -127,6 +179,15 @@ void lcd_enable(void)
  */
 void lcd_print_char(uint8_t data)
 {
+  // Both nibbles in one write, RS is the bus's select line and R/W stays low
+  // from lcd_init()
+  if (bus_fd >= 0) {
+    if (gpio_bus_select(bus_fd, HIGH_VALUE) || write(bus_fd, &data, 1) != 1) {
+      perror("lcd bus write");
+    }
+    return;
+  }
+
   // RS = 1 for user data
   gpio_write_value(GPIO_LCD_RS, HIGH_VALUE);
 
@@ -139,6 +200,16 @@ void lcd_print_char(uint8_t data)
 
 void lcd_print_string(char *message)
 {
+  size_t len = strlen(message);
+
+  // The whole string in one write to the bus device
+  if (bus_fd >= 0) {
+    if (len && (gpio_bus_select(bus_fd, HIGH_VALUE) || write(bus_fd, message, len) != (ssize_t)len)) {
+      perror("lcd bus write");
+    }
+    return;
+  }
+
   do {
     lcd_print_char((uint8_t)*message++);
   } while (*message != '\0');
@@ -147,6 +218,13 @@ void lcd_print_string(char *message)
 // This function sends a command to the LCD
 void lcd_send_command(uint8_t command)
 {
+  if (bus_fd >= 0) {
+    if (gpio_bus_select(bus_fd, LOW_VALUE) || write(bus_fd, &command, 1) != 1) {
+      perror("lcd bus write");
+    }
+    return;
+  }
+
   // RS = 0 for LCD command
   gpio_write_value(GPIO_LCD_RS,LOW_VALUE);
 
@@ -10,6 +10,20 @@
 #define GPIO_LCD_D6 "gpio2.11" // Data line 6
 #define GPIO_LCD_D7 "gpio2.12" // Data line 7
 
+// With the lcd bus node in the DT, RS, EN and D4..D7 belong to /dev/bone_bus_lcd
+// and only RW is a line of its own. Writes then only go through the bus, a failed
+// one is reported rather than retried on the lines it owns. The labels above and
+// the line numbers below are for a DT that declares them all as single lines.
+#define LCD_BUS_LABEL "lcd"
+
+// Same lines as chip device line numbers (DT order under bone_gpio_devs)
+#define LCD_LINE_RS 0
+#define LCD_LINE_RW 1
+#define LCD_LINE_EN 2
+#define LCD_LINE_D4 3
+#define LCD_DATA_MASK (0xfULL << LCD_LINE_D4) // D4..D7
+#define LCD_EN_MASK (1ULL << LCD_LINE_EN)
+
 // LCD commands
 #define LCD_CMD_4DL_2N_5X8F 0x28
 #define LCD_CMD_DON_CURON 0x0E
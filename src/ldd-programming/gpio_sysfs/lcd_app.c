@@ -49,8 +49,19 @@ P9.7(sys_5V supply)               ----             2(VCC)          +5V supply
 // Configure the direction of gpios used for LCD connections
 int init_gpios(void)
 {
-  gpio_configure_dir(GPIO_LCD_RS, GPIO_DIR_OUT);
+  int bus_fd;
+
   gpio_configure_dir(GPIO_LCD_RW, GPIO_DIR_OUT);
+  gpio_write_value(GPIO_LCD_RW, GPIO_LOW_VALUE);
+
+  // The lcd bus node requests its lines as outputs driven low
+  bus_fd = gpio_bus_open(LCD_BUS_LABEL);
+  if (bus_fd >= 0) {
+    gpio_file_close(bus_fd);
+    return 0;
+  }
+
+  gpio_configure_dir(GPIO_LCD_RS, GPIO_DIR_OUT);
   gpio_configure_dir(GPIO_LCD_EN, GPIO_DIR_OUT);
   gpio_configure_dir(GPIO_LCD_D4, GPIO_DIR_OUT);
   gpio_configure_dir(GPIO_LCD_D5, GPIO_DIR_OUT);
@@ -59,7 +70,6 @@ int init_gpios(void)
 
   gpio_write_value(GPIO_LCD_RS, GPIO_LOW_VALUE);
   gpio_write_value(GPIO_LCD_EN, GPIO_LOW_VALUE);
-  gpio_write_value(GPIO_LCD_RW, GPIO_LOW_VALUE);
   gpio_write_value(GPIO_LCD_D4, GPIO_LOW_VALUE);
   gpio_write_value(GPIO_LCD_D5, GPIO_LOW_VALUE);
   gpio_write_value(GPIO_LCD_D6, GPIO_LOW_VALUE);
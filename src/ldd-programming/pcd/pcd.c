@@ -5,6 +5,8 @@
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
 #include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include "pcd_lock_stats.h"
 
 // Format every pr_* message with the current running function name
 #undef pr_fmt
@@ -19,6 +21,11 @@ struct class* pcd_class;
 struct device* pcd_device;
 
 static DEFINE_MUTEX(pcd_lock);
+// Statically tied to its lock, so it is valid before the device is reachable
+static struct pcd_lock_stats pcd_lock_stat = {
+  .lock = &pcd_lock,
+};
+static struct dentry* pcd_debugfs_dir;
 
 static int pcd_open(struct inode* inod, struct file* filp);
 static int pcd_release(struct inode* inod, struct file* filp);
@@ -74,6 +81,10 @@ static int __init pcd_init(void)
     goto cls_destroy;
   }
 
+  // Expose lock contention counters under /sys/kernel/debug/pcd/
+  pcd_debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+  pcd_lock_stats_debugfs_create(&pcd_lock_stat, pcd_debugfs_dir);
+
   pr_info("Module init successful\n");
 
   return 0;
@@ -91,6 +102,7 @@ out:
 
 static void __exit pcd_exit(void)
 {
+  debugfs_remove_recursive(pcd_debugfs_dir);
   device_destroy(pcd_class, device_num);
   class_destroy(pcd_class);
   cdev_del(&pcd_cdev);
@@ -138,7 +150,7 @@ static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
 
 static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
 {
-  if (mutex_lock_interruptible(&pcd_lock)) {
+  if (pcd_lock_stats_lock(&pcd_lock_stat)) {
     return -EINTR;
   }
 
@@ -151,6 +163,7 @@ static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff
   }
 
   if (copy_to_user(buff, &device_buf[*f_pos], count)) {
+    pcd_lock_stats_unlock(&pcd_lock_stat);
     return -EFAULT;
   }
 
@@ -159,7 +172,7 @@ static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff
   pr_info("Number of bytes successfully read = %zu\n", count);
   pr_info("Updated file position %lld = \n", *f_pos);
 
-  mutex_unlock(&pcd_lock);
+  pcd_lock_stats_unlock(&pcd_lock_stat);
 
   // Number of bytes successfully read
   return count;
@@ -167,7 +180,7 @@ static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff
 
 static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
 {
-  if (mutex_lock_interruptible(&pcd_lock)) {
+  if (pcd_lock_stats_lock(&pcd_lock_stat)) {
     return -EINTR;
   }
 
@@ -180,10 +193,12 @@ static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t coun
 
   if (!count) {
     pr_err("No space left on the device\n");
+    pcd_lock_stats_unlock(&pcd_lock_stat);
     return -ENOMEM;
   }
 
   if (copy_from_user(&device_buf[*f_pos], buff, count)) {
+    pcd_lock_stats_unlock(&pcd_lock_stat);
     return -EFAULT;
   }
 
@@ -192,7 +207,7 @@ static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t coun
   pr_info("Number of bytes successfully written = %zu\n", count);
   pr_info("Updated file position %lld = \n", *f_pos);
 
-  mutex_unlock(&pcd_lock);
+  pcd_lock_stats_unlock(&pcd_lock_stat);
 
   return count;
 }
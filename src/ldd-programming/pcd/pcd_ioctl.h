@@ -0,0 +1,16 @@
+#ifndef PCD_IOCTL_H
+#define PCD_IOCTL_H
+
+#include <linux/ioctl.h>
+
+#define PCD_IOC_MAGIC 'p'
+
+// Multi-write transactions. After BEGIN, writes on the same fd are staged in a
+// private copy of the device (and reads on that fd see them). COMMIT publishes all
+// staged writes at once, or fails with EAGAIN if the device changed since BEGIN.
+// ABORT, or closing the fd, discards them.
+#define PCD_IOC_TXN_BEGIN _IO(PCD_IOC_MAGIC, 1)
+#define PCD_IOC_TXN_COMMIT _IO(PCD_IOC_MAGIC, 2)
+#define PCD_IOC_TXN_ABORT _IO(PCD_IOC_MAGIC, 3)
+
+#endif // PCD_IOCTL_H
@@ -0,0 +1,120 @@
+#ifndef PCD_LOCK_STATS_H
+#define PCD_LOCK_STATS_H
+
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include <linux/string.h>
+
+// Contention counters for one device lock. Everything except the lock
+// pointer is only updated while holding that lock, so no extra locking is needed.
+struct pcd_lock_stats {
+  struct mutex* lock;
+  u64 acquisitions;
+  u64 contended;
+  u64 wait_total_ns;
+  u64 wait_max_ns;
+  u64 hold_total_ns;
+  u64 hold_max_ns;
+  ktime_t acquired_at;
+};
+
+static inline void pcd_lock_stats_init(struct pcd_lock_stats* stats, struct mutex* lock)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->lock = lock;
+}
+
+// Drop-in replacement for mutex_lock_interruptible() that records how long we waited.
+// The trylock fast path keeps the uncontended case from paying for two ktime_get() calls.
+static inline int pcd_lock_stats_lock(struct pcd_lock_stats* stats)
+{
+  u64 wait_ns = 0;
+  ktime_t start;
+
+  if (!mutex_trylock(stats->lock)) {
+    start = ktime_get();
+    if (mutex_lock_interruptible(stats->lock)) {
+      return -EINTR;
+    }
+    wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    stats->contended++;
+  }
+
+  stats->acquisitions++;
+  stats->wait_total_ns += wait_ns;
+  if (wait_ns > stats->wait_max_ns) {
+    stats->wait_max_ns = wait_ns;
+  }
+  stats->acquired_at = ktime_get();
+
+  return 0;
+}
+
+static inline void pcd_lock_stats_unlock(struct pcd_lock_stats* stats)
+{
+  u64 hold_ns = ktime_to_ns(ktime_sub(ktime_get(), stats->acquired_at));
+
+  stats->hold_total_ns += hold_ns;
+  if (hold_ns > stats->hold_max_ns) {
+    stats->hold_max_ns = hold_ns;
+  }
+
+  mutex_unlock(stats->lock);
+}
+
+static int pcd_lock_stats_show(struct seq_file* s, void* unused)
+{
+  struct pcd_lock_stats* stats = s->private;
+  struct pcd_lock_stats snap;
+
+  // Take the raw mutex so that reading the stats doesn't show up in them
+  if (mutex_lock_interruptible(stats->lock)) {
+    return -EINTR;
+  }
+  snap = *stats;
+  mutex_unlock(stats->lock);
+
+  seq_printf(s, "acquisitions: %llu\n", snap.acquisitions);
+  seq_printf(s, "contended: %llu\n", snap.contended);
+  seq_printf(s, "wait_total_ns: %llu\n", snap.wait_total_ns);
+  seq_printf(s, "wait_max_ns: %llu\n", snap.wait_max_ns);
+  seq_printf(s, "hold_total_ns: %llu\n", snap.hold_total_ns);
+  seq_printf(s, "hold_max_ns: %llu\n", snap.hold_max_ns);
+
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pcd_lock_stats);
+
+// Any write to the reset file clears the counters
+static ssize_t pcd_lock_stats_reset_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
+{
+  struct pcd_lock_stats* stats = filp->private_data;
+  struct mutex* lock = stats->lock;
+
+  if (mutex_lock_interruptible(lock)) {
+    return -EINTR;
+  }
+  pcd_lock_stats_init(stats, lock);
+  mutex_unlock(lock);
+
+  return count;
+}
+
+static const struct file_operations pcd_lock_stats_reset_fops = {
+  .open = simple_open,
+  .write = pcd_lock_stats_reset_write,
+  .llseek = noop_llseek,
+  .owner = THIS_MODULE,
+};
+
+// Creates <parent>/lock_stats and <parent>/lock_stats_reset
+static inline void pcd_lock_stats_debugfs_create(struct pcd_lock_stats* stats, struct dentry* parent)
+{
+  debugfs_create_file("lock_stats", 0400, parent, stats, &pcd_lock_stats_fops);
+  debugfs_create_file("lock_stats_reset", 0200, parent, stats, &pcd_lock_stats_reset_fops);
+}
+
+#endif // PCD_LOCK_STATS_H
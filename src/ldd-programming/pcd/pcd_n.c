@@ -4,6 +4,14 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/scatterlist.h>
+#include <crypto/aes.h>
+#include <crypto/skcipher.h>
+#include "pcd_lock_stats.h"
+#include "pcd_ioctl.h"
 
 // Format every pr_* message with the current running function name
 #undef pr_fmt
@@ -16,14 +24,15 @@
 #define MEM_SIZE_MAX_PCDEV3 1024
 #define MEM_SIZE_MAX_PCDEV4 512
 
+// XTS data unit. Every encrypted device size must be a multiple of this.
+#define PCD_CRYPT_UNIT_SIZE 512
+#define PCD_CRYPT_KEY_SIZE (2 * AES_KEYSIZE_256)
+
 #define RDONLY 0x01
 #define WRONLY 0x10
 #define RDWR 0x11
 
-char device_buf_pcdev1[MEM_SIZE_MAX_PCDEV1];
-char device_buf_pcdev2[MEM_SIZE_MAX_PCDEV2];
-char device_buf_pcdev3[MEM_SIZE_MAX_PCDEV3];
-char device_buf_pcdev4[MEM_SIZE_MAX_PCDEV4];
+struct pcd_crypt_ctx;
 
 // Device private data structure
 static const struct pcdevice_priv_data {
@@ -33,6 +42,19 @@ static const struct pcdevice_priv_data {
   int perm;
   struct cdev pcd_cdev;
   struct mutex pcdev_lock;
+  struct pcd_lock_stats lock_stats;
+  struct crypto_skcipher* tfm;
+  struct pcd_crypt_ctx* crypt; // Requests reused by every I/O, with tfm
+  u64 version; // Bumped on every change of buf, under pcdev_lock
+};
+
+// Per open file state. While a transaction is open the file stages its
+// writes (and sees its own reads) in a private copy of the device buffer.
+struct pcd_file_ctx {
+  struct pcdevice_priv_data* pcdev_data;
+  struct mutex txn_lock;
+  char* txn_buf;
+  u64 txn_version;
 };
 
 // Driver's private data structure
@@ -41,6 +63,7 @@ static const struct pcdriver_priv_data {
   dev_t device_num;
   struct class* pcd_class;
   struct device* pcd_device;
+  struct dentry* debugfs_dir;
   struct pcdevice_priv_data pcdevice_data[NO_OF_DEVICES];
 };
 
@@ -48,25 +71,21 @@ struct pcdriver_priv_data pcdrv_data = {
   .total_devices = NO_OF_DEVICES,
   .pcdevice_data = {
     [0] = {
-      .buf = device_buf_pcdev1,
       .size = MEM_SIZE_MAX_PCDEV1,
       .serial_num = "PCDEV1XYIOWEFJ",
       .perm = RDONLY,
     },
     [1] = {
-      .buf = device_buf_pcdev2,
       .size = MEM_SIZE_MAX_PCDEV2,
       .serial_num = "PCDEV2XYIOWEFJ",
       .perm = WRONLY,
     },
     [2] = {
-      .buf = device_buf_pcdev3,
       .size = MEM_SIZE_MAX_PCDEV3,
       .serial_num = "PCDEV3XYIOWEFJ",
       .perm = RDWR,
     },
     [3] = {
-      .buf = device_buf_pcdev4,
       .size = MEM_SIZE_MAX_PCDEV4,
       .serial_num = "PCDEV4XYIOWEFJ",
       .perm = RDWR,
@@ -79,15 +98,291 @@ static int pcd_release(struct inode* inod, struct file* filp);
 static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos);
 static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos);
 static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence);
+static long pcd_ioctl(struct file* filp, unsigned int cmd, unsigned long arg);
 
 static const struct file_operations pcd_fops = {
   .open = pcd_open,
   .release = pcd_release,
   .read = pcd_read,
   .write = pcd_write,
+  .unlocked_ioctl = pcd_ioctl,
   .owner = THIS_MODULE,
 };
 
+// Bit n selects pcdev-<n+1>, e.g. encrypt_mask=0x8 keeps pcdev-4 encrypted in RAM
+static unsigned int encrypt_mask;
+module_param(encrypt_mask, uint, 0444);
+MODULE_PARM_DESC(encrypt_mask, "Bitmask of devices whose buffers are kept AES-XTS encrypted");
+
+// A page worth of XTS data units is queued before any of them is waited on
+#define PCD_CRYPT_BATCH (PAGE_SIZE / PCD_CRYPT_UNIT_SIZE)
+
+// One in-flight skcipher request per XTS data unit
+struct pcd_crypt_req {
+  struct skcipher_request* req;
+  struct crypto_wait wait;
+  struct scatterlist sg_src;
+  struct scatterlist sg_dst;
+  __le64 iv[2];
+  int err;
+};
+
+// Allocated with the tfm and reused by every I/O on the device. Transactions
+// en/decrypt their staged copies outside pcdev_lock, hence a lock of its own.
+struct pcd_crypt_ctx {
+  struct mutex lock;
+  struct pcd_crypt_req reqs[PCD_CRYPT_BATCH];
+};
+
+// En/decrypts nr_units consecutive data units from src into dst (may be the same buffer).
+// Units go out a page at a time: every request of the batch is queued before we wait
+// on any of them, so async implementations (AES-NI through cryptd, hardware engines)
+// get the whole page in one go.
+static int pcd_crypt_units(struct pcdevice_priv_data* pcdev_data, char* dst, const char* src, unsigned int first_unit, unsigned int nr_units, bool encrypt)
+{
+  struct pcd_crypt_ctx* crypt = pcdev_data->crypt;
+  struct pcd_crypt_req* r;
+  unsigned int done;
+  unsigned int batch;
+  unsigned int unit;
+  unsigned int i;
+  int ret = 0;
+  int err;
+
+  mutex_lock(&crypt->lock);
+
+  for (done = 0; done < nr_units && !ret; done += batch) {
+    batch = min_t(unsigned int, nr_units - done, PCD_CRYPT_BATCH);
+
+    for (i = 0; i < batch; i++) {
+      r = &crypt->reqs[i];
+      unit = done + i;
+
+      // plain64 tweak: the data unit index within the device
+      r->iv[0] = cpu_to_le64(first_unit + unit);
+      r->iv[1] = 0;
+      sg_init_one(&r->sg_src, src + unit * PCD_CRYPT_UNIT_SIZE, PCD_CRYPT_UNIT_SIZE);
+      sg_init_one(&r->sg_dst, dst + unit * PCD_CRYPT_UNIT_SIZE, PCD_CRYPT_UNIT_SIZE);
+
+      crypto_init_wait(&r->wait);
+      skcipher_request_set_crypt(r->req, &r->sg_src, &r->sg_dst, PCD_CRYPT_UNIT_SIZE, (u8*)r->iv);
+
+      r->err = encrypt ? crypto_skcipher_encrypt(r->req) : crypto_skcipher_decrypt(r->req);
+    }
+
+    for (i = 0; i < batch; i++) {
+      r = &crypt->reqs[i];
+      err = crypto_wait_req(r->err, &r->wait);
+      if (err && !ret) {
+        ret = err;
+      }
+    }
+  }
+
+  mutex_unlock(&crypt->lock);
+
+  return ret;
+}
+
+static void pcd_crypt_free_ctx(struct pcd_crypt_ctx* crypt)
+{
+  unsigned int i;
+
+  for (i = 0; i < PCD_CRYPT_BATCH; i++) {
+    skcipher_request_free(crypt->reqs[i].req);
+  }
+
+  kfree(crypt);
+}
+
+static struct pcd_crypt_ctx* pcd_crypt_alloc_ctx(struct crypto_skcipher* tfm)
+{
+  struct pcd_crypt_ctx* crypt;
+  struct pcd_crypt_req* r;
+  unsigned int i;
+
+  crypt = kzalloc(sizeof(*crypt), GFP_KERNEL);
+  if (!crypt) {
+    return NULL;
+  }
+
+  mutex_init(&crypt->lock);
+
+  for (i = 0; i < PCD_CRYPT_BATCH; i++) {
+    r = &crypt->reqs[i];
+    r->req = skcipher_request_alloc(tfm, GFP_KERNEL);
+    if (!r->req) {
+      pcd_crypt_free_ctx(crypt);
+      return NULL;
+    }
+    skcipher_request_set_callback(r->req, CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP, crypto_req_done, &r->wait);
+  }
+
+  return crypt;
+}
+
+// Decrypts the data units of buf covering [pos, pos + count) and copies the plaintext out
+static int pcd_crypt_read(struct pcdevice_priv_data* pcdev_data, char* buf, char __user* buff, size_t count, loff_t pos)
+{
+  unsigned int first = pos / PCD_CRYPT_UNIT_SIZE;
+  unsigned int nr = DIV_ROUND_UP(pos + count, PCD_CRYPT_UNIT_SIZE) - first;
+  char* bounce;
+  int ret;
+
+  if (!count) {
+    return 0;
+  }
+
+  bounce = kmalloc(nr * PCD_CRYPT_UNIT_SIZE, GFP_KERNEL);
+  if (!bounce) {
+    return -ENOMEM;
+  }
+
+  ret = pcd_crypt_units(pcdev_data, bounce, buf + first * PCD_CRYPT_UNIT_SIZE, first, nr, false);
+  if (!ret && copy_to_user(buff, bounce + (pos - first * PCD_CRYPT_UNIT_SIZE), count)) {
+    ret = -EFAULT;
+  }
+
+  kfree_sensitive(bounce);
+
+  return ret;
+}
+
+// Read-modify-write of the data units covering [pos, pos + count). Only the
+// partially overwritten units at either edge need their old plaintext.
+static int pcd_crypt_write(struct pcdevice_priv_data* pcdev_data, char* buf, const char __user* buff, size_t count, loff_t pos)
+{
+  unsigned int first = pos / PCD_CRYPT_UNIT_SIZE;
+  unsigned int nr = DIV_ROUND_UP(pos + count, PCD_CRYPT_UNIT_SIZE) - first;
+  unsigned int offset = pos - first * PCD_CRYPT_UNIT_SIZE;
+  char* base = buf + first * PCD_CRYPT_UNIT_SIZE;
+  char* bounce;
+  int ret = 0;
+
+  bounce = kmalloc(nr * PCD_CRYPT_UNIT_SIZE, GFP_KERNEL);
+  if (!bounce) {
+    return -ENOMEM;
+  }
+
+  if (offset) {
+    ret = pcd_crypt_units(pcdev_data, bounce, base, first, 1, false);
+  }
+  if (!ret && ((offset + count) % PCD_CRYPT_UNIT_SIZE) && (nr > 1 || !offset)) {
+    ret = pcd_crypt_units(pcdev_data, bounce + (nr - 1) * PCD_CRYPT_UNIT_SIZE, base + (nr - 1) * PCD_CRYPT_UNIT_SIZE, first + nr - 1, 1, false);
+  }
+  if (!ret && copy_from_user(bounce + offset, buff, count)) {
+    ret = -EFAULT;
+  }
+  if (!ret) {
+    ret = pcd_crypt_units(pcdev_data, base, bounce, first, nr, true);
+  }
+
+  kfree_sensitive(bounce);
+
+  return ret;
+}
+
+// Keys the device with a random per-device key that never leaves the kernel
+static int pcd_crypt_init_device(struct pcdevice_priv_data* pcdev_data, int index)
+{
+  u8 key[PCD_CRYPT_KEY_SIZE];
+  int ret;
+
+  if (pcdev_data->size % PCD_CRYPT_UNIT_SIZE) {
+    pr_err("pcdev-%d size %u is not a multiple of %d\n", index + 1, pcdev_data->size, PCD_CRYPT_UNIT_SIZE);
+    return -EINVAL;
+  }
+
+  // With no type/mask restrictions the crypto API hands back the highest
+  // priority xts(aes) implementation, async ones (AES-NI, CAAM, ...) included
+  pcdev_data->tfm = crypto_alloc_skcipher("xts(aes)", 0, 0);
+  if (IS_ERR(pcdev_data->tfm)) {
+    ret = PTR_ERR(pcdev_data->tfm);
+    pcdev_data->tfm = NULL;
+    pr_err("xts(aes) not available\n");
+    return ret;
+  }
+
+  get_random_bytes(key, sizeof(key));
+  ret = crypto_skcipher_setkey(pcdev_data->tfm, key, sizeof(key));
+  memzero_explicit(key, sizeof(key));
+  if (ret) {
+    goto free_tfm;
+  }
+
+  pcdev_data->crypt = pcd_crypt_alloc_ctx(pcdev_data->tfm);
+  if (!pcdev_data->crypt) {
+    ret = -ENOMEM;
+    goto free_tfm;
+  }
+
+  // Start out holding the ciphertext of the zeroed buffer
+  ret = pcd_crypt_units(pcdev_data, pcdev_data->buf, pcdev_data->buf, 0, pcdev_data->size / PCD_CRYPT_UNIT_SIZE, true);
+  if (ret) {
+    goto free_ctx;
+  }
+
+  pr_info("pcdev-%d encrypted with %s\n", index + 1, crypto_skcipher_driver_name(pcdev_data->tfm));
+
+  return 0;
+
+free_ctx:
+  pcd_crypt_free_ctx(pcdev_data->crypt);
+  pcdev_data->crypt = NULL;
+free_tfm:
+  crypto_free_skcipher(pcdev_data->tfm);
+  pcdev_data->tfm = NULL;
+  return ret;
+}
+
+static void pcd_crypt_free_device(struct pcdevice_priv_data* pcdev_data)
+{
+  if (!pcdev_data->tfm) {
+    return;
+  }
+
+  pcd_crypt_free_ctx(pcdev_data->crypt);
+  pcdev_data->crypt = NULL;
+  crypto_free_skcipher(pcdev_data->tfm);
+  pcdev_data->tfm = NULL;
+}
+
+// Copies count bytes at pos out of buf, which is either the live device buffer
+// or a transaction's staged copy
+static int pcd_copy_out(struct pcdevice_priv_data* pcdev_data, char* buf, char __user* buff, size_t count, loff_t pos)
+{
+  if (pcdev_data->tfm) {
+    return pcd_crypt_read(pcdev_data, buf, buff, count, pos);
+  }
+
+  return copy_to_user(buff, buf + pos, count) ? -EFAULT : 0;
+}
+
+static int pcd_copy_in(struct pcdevice_priv_data* pcdev_data, char* buf, const char __user* buff, size_t count, loff_t pos)
+{
+  if (pcdev_data->tfm) {
+    return pcd_crypt_write(pcdev_data, buf, buff, count, pos);
+  }
+
+  return copy_from_user(buf + pos, buff, count) ? -EFAULT : 0;
+}
+
+// Lock contention counters live under /sys/kernel/debug/pcd_n/pcdev-<n>/
+static void pcd_debugfs_init(void)
+{
+  struct dentry* dev_dir;
+  char name[16];
+  int i;
+
+  pcdrv_data.debugfs_dir = debugfs_create_dir(KBUILD_MODNAME, NULL);
+
+  for (i = 0; i < NO_OF_DEVICES; i++) {
+    snprintf(name, sizeof(name), "pcdev-%d", i + 1);
+    dev_dir = debugfs_create_dir(name, pcdrv_data.debugfs_dir);
+    pcd_lock_stats_debugfs_create(&pcdrv_data.pcdevice_data[i].lock_stats, dev_dir);
+  }
+}
+
 static int __init pcd_init(void)
 {
   int ret;
@@ -116,6 +411,21 @@ static int __init pcd_init(void)
     );
 
     mutex_init(&pcdrv_data.pcdevice_data[i].pcdev_lock);
+    pcd_lock_stats_init(&pcdrv_data.pcdevice_data[i].lock_stats, &pcdrv_data.pcdevice_data[i].pcdev_lock);
+
+    // Heap allocated so a transaction commit can swap in its staged copy
+    pcdrv_data.pcdevice_data[i].buf = kzalloc(pcdrv_data.pcdevice_data[i].size, GFP_KERNEL);
+    if (!pcdrv_data.pcdevice_data[i].buf) {
+      ret = -ENOMEM;
+      goto unwind_devices;
+    }
+
+    if (encrypt_mask & BIT(i)) {
+      ret = pcd_crypt_init_device(&pcdrv_data.pcdevice_data[i], i);
+      if (ret) {
+        goto free_buf;
+      }
+    }
 
     // Initialize cdev structure with fops
     cdev_init(&pcdrv_data.pcdevice_data[i].cdev, &pcd_fops);
@@ -125,7 +435,7 @@ static int __init pcd_init(void)
     ret = cdev_add(&pcdrv_data.pcdevice_data[i].cdev, pcdrv_data.device_num + i, 1);
     if (ret < 0) {
       pr_err("Cdev add failed\n");
-      goto cdev_destroy;
+      goto free_buf;
     }
 
     // Populate with device information
@@ -133,19 +443,28 @@ static int __init pcd_init(void)
     if (IS_ERR(pcdrv_data.pcd_device)) {
       pr_err("Device create failed\n");
       ret = PTR_ERR(pcdrv_data.pcd_device);
-      goto cls_destroy;
+      goto cdev_del;
     }
   }
 
+  pcd_debugfs_init();
+
   pr_info("Module init successful\n");
 
   return 0;
 
-cdev_destroy:
-cls_destroy:
-  for (; i >= 0; i--) {
+  // Device i only got as far as the label jumped to, the ones before it are complete
+cdev_del:
+  cdev_del(&pcdrv_data.pcdevice_data[i].cdev);
+free_buf:
+  pcd_crypt_free_device(&pcdrv_data.pcdevice_data[i]);
+  kfree_sensitive(pcdrv_data.pcdevice_data[i].buf);
+unwind_devices:
+  while (i--) {
     device_destroy(pcdrv_data.pcd_class, pcdrv_data.device_num + i);
     cdev_del(&pcdrv_data.pcdevice_data[i].cdev);
+    pcd_crypt_free_device(&pcdrv_data.pcdevice_data[i]);
+    kfree_sensitive(pcdrv_data.pcdevice_data[i].buf);
   }
   class_destroy(pcdrv_data.pcd_class);
 
@@ -160,9 +479,14 @@ out:
 static void __exit pcd_exit(void)
 {
   int i;
+
+  debugfs_remove_recursive(pcdrv_data.debugfs_dir);
+
   for (i = 0; i < NO_OF_DEVICES; i++) {
     device_destroy(pcdrv_data.pcd_class, pcdrv_data.device_num + i);
     cdev_del(&pcdrv_data.pcdevice_data[i].cdev);
+    pcd_crypt_free_device(&pcdrv_data.pcdevice_data[i]);
+    kfree_sensitive(pcdrv_data.pcdevice_data[i].buf);
   }
   class_destroy(pcdrv_data.pcd_class);
   unregister_chrdev_region(pcdrv_data.device_num, NO_OF_DEVICES);
@@ -175,8 +499,8 @@ static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
   pr_info("Lseek requested\n");
   pr_info("Current value of the file position = %lld\n", filp->f_pos);
 
-  struct pcdevice_priv_data* pcdev_data = (struct pcdevice_priv_data*)filp->private_data;
-  int max_size = pcdev_data->size;
+  struct pcd_file_ctx* ctx = (struct pcd_file_ctx*)filp->private_data;
+  int max_size = ctx->pcdev_data->size;
   loff_t temp;
 
   switch(whence) {
@@ -211,20 +535,35 @@ static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
 
 static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
 {
-  mutex_lock(&pcdev_data->pcdev_lock);
+  struct pcd_file_ctx* ctx = (struct pcd_file_ctx*)filp->private_data;
+  struct pcdevice_priv_data* pcdev_data = ctx->pcdev_data;
+  int max_size = pcdev_data->size;
+  int ret;
+
+  if (mutex_lock_interruptible(&ctx->txn_lock)) {
+    return -EINTR;
+  }
 
   pr_info("Read requested for %zu bytes\n", count);
   pr_info("Current file position %lld = \n", *f_pos);
 
-  struct pcdevice_priv_data* pcdev_data = (struct pcdevice_priv_data*)filp->private_data;
-  int max_size = pcdev_data->size;
-
   if ((*f_pos + count) > max_size) {
     count = max_size - *f_pos;
   }
 
-  if (copy_to_user(buff, pcdev_data->buf + (*f_pos), count)) {
-    return -EFAULT;
+  if (ctx->txn_buf) {
+    // Inside a transaction this file reads its own staged copy
+    ret = pcd_copy_out(pcdev_data, ctx->txn_buf, buff, count, *f_pos);
+  } else if (pcd_lock_stats_lock(&pcdev_data->lock_stats)) {
+    ret = -EINTR;
+  } else {
+    ret = pcd_copy_out(pcdev_data, pcdev_data->buf, buff, count, *f_pos);
+    pcd_lock_stats_unlock(&pcdev_data->lock_stats);
+  }
+
+  if (ret) {
+    mutex_unlock(&ctx->txn_lock);
+    return ret;
   }
 
   *f_pos += count;
@@ -232,7 +571,7 @@ static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff
   pr_info("Number of bytes successfully read = %zu\n", count);
   pr_info("Updated file position %lld = \n", *f_pos);
 
-  mutex_unlock(&pcdev_data->pcdev_lock);
+  mutex_unlock(&ctx->txn_lock);
 
   // Number of bytes successfully read
   return count;
@@ -243,10 +582,10 @@ static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t coun
   pr_info("Read requested for %zu bytes\n", count);
   pr_info("Current file position %lld = \n", *f_pos);
 
-  struct pcdevice_priv_data* pcdev_data = (struct pcdevice_priv_data*)filp->private_data;
+  struct pcd_file_ctx* ctx = (struct pcd_file_ctx*)filp->private_data;
+  struct pcdevice_priv_data* pcdev_data = ctx->pcdev_data;
   int max_size = pcdev_data->size;
-
-  mutex_lock(&pcdev_data->pcdev_lock);
+  int ret;
 
   if ((*f_pos + count) > max_size) {
     count = max_size - *f_pos;
@@ -257,8 +596,26 @@ static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t coun
     return -ENOMEM;
   }
 
-  if (copy_from_user(pcdev_data->buf + (*f_pos), buff, count)) {
-    return -EFAULT;
+  if (mutex_lock_interruptible(&ctx->txn_lock)) {
+    return -EINTR;
+  }
+
+  if (ctx->txn_buf) {
+    // Staged writes never touch the device lock, so readers are not held up
+    ret = pcd_copy_in(pcdev_data, ctx->txn_buf, buff, count, *f_pos);
+  } else if (pcd_lock_stats_lock(&pcdev_data->lock_stats)) {
+    ret = -EINTR;
+  } else {
+    ret = pcd_copy_in(pcdev_data, pcdev_data->buf, buff, count, *f_pos);
+    if (!ret) {
+      pcdev_data->version++;
+    }
+    pcd_lock_stats_unlock(&pcdev_data->lock_stats);
+  }
+
+  if (ret) {
+    mutex_unlock(&ctx->txn_lock);
+    return ret;
   }
 
   *f_pos += count;
@@ -266,11 +623,113 @@ static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t coun
   pr_info("Number of bytes successfully written = %zu\n", count);
   pr_info("Updated file position %lld = \n", *f_pos);
 
-  mutex_unlock(&pcdev_data->pcdev_lock);
+  mutex_unlock(&ctx->txn_lock);
 
   return count;
 }
 
+// Snapshots the device buffer as the transaction's staged copy. For encrypted
+// devices this is ciphertext, which stays valid since the tweak is the unit index.
+static int pcd_txn_begin(struct pcd_file_ctx* ctx)
+{
+  struct pcdevice_priv_data* pcdev_data = ctx->pcdev_data;
+  char* staged;
+
+  if (ctx->txn_buf) {
+    return -EBUSY;
+  }
+
+  staged = kmalloc(pcdev_data->size, GFP_KERNEL);
+  if (!staged) {
+    return -ENOMEM;
+  }
+
+  if (pcd_lock_stats_lock(&pcdev_data->lock_stats)) {
+    kfree(staged);
+    return -EINTR;
+  }
+  memcpy(staged, pcdev_data->buf, pcdev_data->size);
+  ctx->txn_version = pcdev_data->version;
+  pcd_lock_stats_unlock(&pcdev_data->lock_stats);
+
+  ctx->txn_buf = staged;
+
+  return 0;
+}
+
+static void pcd_txn_abort(struct pcd_file_ctx* ctx)
+{
+  kfree_sensitive(ctx->txn_buf);
+  ctx->txn_buf = NULL;
+}
+
+// Publishes the staged copy by swapping buffer pointers, so readers see either
+// none or all of the transaction. If anyone changed the device since begin the
+// transaction is dropped with -EAGAIN rather than silently losing their update.
+static int pcd_txn_commit(struct pcd_file_ctx* ctx)
+{
+  struct pcdevice_priv_data* pcdev_data = ctx->pcdev_data;
+  char* old;
+
+  if (!ctx->txn_buf) {
+    return -EINVAL;
+  }
+
+  if (pcd_lock_stats_lock(&pcdev_data->lock_stats)) {
+    return -EINTR;
+  }
+
+  if (pcdev_data->version != ctx->txn_version) {
+    pcd_lock_stats_unlock(&pcdev_data->lock_stats);
+    pcd_txn_abort(ctx);
+    return -EAGAIN;
+  }
+
+  old = pcdev_data->buf;
+  pcdev_data->buf = ctx->txn_buf;
+  pcdev_data->version++;
+
+  pcd_lock_stats_unlock(&pcdev_data->lock_stats);
+
+  ctx->txn_buf = NULL;
+  kfree_sensitive(old);
+
+  return 0;
+}
+
+static long pcd_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+  struct pcd_file_ctx* ctx = (struct pcd_file_ctx*)filp->private_data;
+  int ret;
+
+  if (!(filp->f_mode & FMODE_WRITE)) {
+    return -EBADF;
+  }
+
+  if (mutex_lock_interruptible(&ctx->txn_lock)) {
+    return -EINTR;
+  }
+
+  switch (cmd) {
+    case PCD_IOC_TXN_BEGIN:
+      ret = pcd_txn_begin(ctx);
+      break;
+    case PCD_IOC_TXN_COMMIT:
+      ret = pcd_txn_commit(ctx);
+      break;
+    case PCD_IOC_TXN_ABORT:
+      ret = ctx->txn_buf ? 0 : -EINVAL;
+      pcd_txn_abort(ctx);
+      break;
+    default:
+      ret = -ENOTTY;
+  }
+
+  mutex_unlock(&ctx->txn_lock);
+
+  return ret;
+}
+
 static int check_permission(int dev_perm, int access_mode)
 {
   if (dev_perm == RDWR) {
@@ -295,11 +754,9 @@ static int pcd_open(struct inode* inod, struct file* filp)
 
   // Get the pcdevice_priv_data structure from the inode
   struct pcdevice_priv_data* pcdev_data;
+  struct pcd_file_ctx* ctx;
   pcdev_data = container_of(inod->i_cdev, struct pcdevice_priv_data, pcd_cdev);
 
-  // Supply device private data to other methods of the driver
-  filp->private_data = pcdev_data;
-
   // Find out on which device file open was attempted by the user space
   minor_num = MINOR(inod->i_rdev);
   pr_info("Minor access = %d\n", minor_num);
@@ -308,12 +765,31 @@ static int pcd_open(struct inode* inod, struct file* filp)
   ret = check_permission(pcdev_data->perm, filp->f_mode);
 
   (!ret) ? pr_info("open successful\n") : pr_info("open was unsuccessful\n");
-  
-  return ret;
+  if (ret) {
+    return ret;
+  }
+
+  ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+  if (!ctx) {
+    return -ENOMEM;
+  }
+  ctx->pcdev_data = pcdev_data;
+  mutex_init(&ctx->txn_lock);
+
+  // Supply per file state (and through it the device) to other methods of the driver
+  filp->private_data = ctx;
+
+  return 0;
 }
 
 static int pcd_release(struct inode* inod, struct file* filp)
 {
+  struct pcd_file_ctx* ctx = (struct pcd_file_ctx*)filp->private_data;
+
+  // An uncommitted transaction is aborted when its file goes away
+  pcd_txn_abort(ctx);
+  kfree(ctx);
+
   pr_info("release successful\n");
   return 0;
 }
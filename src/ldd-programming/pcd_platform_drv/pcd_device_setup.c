@@ -1,98 +1,416 @@
+/*
+ * Registers pcd platform devices in bulk and optionally hammers the drivers with
+ * concurrent add/remove cycles, reporting probe and remove latency percentiles
+ * and how much memory the devices cost. No device tree needed, e.g. on x86:
+ *
+ *   insmod pcd_platform_driver_dt.ko sync_probe=1
+ *   insmod pcd_device_setup.ko count=1000 size_dist=pow2 size_min=32 size_max=65536
+ *   insmod pcd_device_setup.ko count=0 stress_threads=8 stress_iters=500
+ *
+ * Latencies are those of platform_device_register_full()/platform_device_unregister(),
+ * so they only include the driver's probe when it probes synchronously.
+ */
+
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/random.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/string.h>
 #include <platform.h>
 
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt,__func__
 
-static void pcdev_release(void);
-
-struct pcdev_platform_data pcdev_pltfrm_data[] = {
-  [0]: {
-    .size = 512,
-    .perm = RDWR,
-    .serial_num = "pcdevabc2023",
-  },
-  [1]: {
-    .size = 1024,
-    .perm = RDWR,
-    .serial_num = "pcdevdef2023",
-  },
-  [2]: {
-    .size = 128,
-    .perm = RDONLY,
-    .serial_num = "pcdevghi2023",
-  },
-  [3]: {
-    .size = 32,
-    .perm = WRONLY,
-    .serial_num = "pcdevjkl2023",
-  },
+#define PCDEV_SERIAL_LEN 16
+
+static unsigned int count = 4;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Number of devices registered at load and kept until unload");
+
+static char* size_dist = "fixed";
+module_param(size_dist, charp, 0444);
+MODULE_PARM_DESC(size_dist, "Device size distribution: fixed (size_min), uniform or pow2 in [size_min, size_max]");
+
+static unsigned int size_min = 512;
+module_param(size_min, uint, 0444);
+MODULE_PARM_DESC(size_min, "Smallest device size in bytes");
+
+static unsigned int size_max = 4096;
+module_param(size_max, uint, 0444);
+MODULE_PARM_DESC(size_max, "Largest device size in bytes");
+
+static unsigned int stress_threads;
+module_param(stress_threads, uint, 0444);
+MODULE_PARM_DESC(stress_threads, "Threads concurrently adding and removing devices at load, 0 to skip");
+
+static unsigned int stress_iters = 100;
+module_param(stress_iters, uint, 0444);
+MODULE_PARM_DESC(stress_iters, "Add/remove cycles per stress thread");
+
+// One entry per id in the drivers' id tables, devices are spread across them
+static const char* const pcdev_names[] = {
+  "pcdev-A1x",
+  "pcdev-B1x",
+  "pcdev-C1x",
+  "pcdev-D1x",
 };
 
-struct platform_device platform_pcdev_1 = {
-  .name = "pcdev-A1x",
-  .id = 0,
-  .dev {
-    .platform_data = &pcdev_platform_data[0],
-    .release = pcdev_release,
-  },
+static const int pcdev_perms[] = {
+  RDWR,
+  RDWR,
+  RDONLY,
+  WRONLY,
 };
 
-struct platform_device platform_pcdev_2 = {
-  .name = "pcdev-B1x",
-  .id = 1,
-  .dev {
-    .platform_data = &pcdev_platform_data[1],
-    .release = pcdev_release,
-  },
+enum pcdev_size_dist {
+  PCDEV_SIZE_FIXED,
+  PCDEV_SIZE_UNIFORM,
+  PCDEV_SIZE_POW2,
 };
 
-struct platform_device platform_pcdev_3 = {
-  .name = "pcdev-C1x",
-  .id = 2,
-  .dev {
-    .platform_data = &pcdev_platform_data[2],
-    .release = pcdev_release,
-  },
+struct pcdev_latency {
+  u64* samples; // ns
+  unsigned int nr;
 };
 
-struct platform_device platform_pcdev_4 = {
-  .name = "pcdev-D1x",
-  .id = 3,
-  .dev {
-    .platform_data = &pcdev_platform_data[3],
-    .release = pcdev_release,
-  },
+struct pcdev_stress_worker {
+  unsigned int id;
+  struct pcdev_latency probe;
+  struct pcdev_latency remove;
+  int ret;
+  struct completion done;
 };
 
-struct platform_device* platform_pcdevs[] = {
-  &platform_pcdev_1,
-  &platform_pcdev_2,
-  &platform_pcdev_3,
-  &platform_pcdev_4,
+static enum pcdev_size_dist pcdev_dist;
+static struct platform_device** pcdevs;
+static char (*pcdev_serials)[PCDEV_SERIAL_LEN];
+static unsigned int nr_pcdevs;
+
+static int pcdev_parse_size_dist(void)
+{
+  if (!strcmp(size_dist, "fixed")) {
+    pcdev_dist = PCDEV_SIZE_FIXED;
+  } else if (!strcmp(size_dist, "uniform")) {
+    pcdev_dist = PCDEV_SIZE_UNIFORM;
+  } else if (!strcmp(size_dist, "pow2")) {
+    pcdev_dist = PCDEV_SIZE_POW2;
+  } else {
+    pr_err("Unknown size distribution %s\n", size_dist);
+    return -EINVAL;
+  }
+
+  if (!size_min || size_min > size_max) {
+    pr_err("Invalid size range [%u, %u]\n", size_min, size_max);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+static u64 pcdev_pick_size(void)
+{
+  unsigned int lo;
+  unsigned int hi;
+
+  switch (pcdev_dist) {
+    case PCDEV_SIZE_UNIFORM:
+      return size_min + get_random_u32_below(size_max - size_min + 1);
+    case PCDEV_SIZE_POW2:
+      // Every power of two in the range is equally likely, so small devices dominate
+      lo = order_base_2(size_min);
+      hi = ilog2(size_max);
+      if (lo > hi) {
+        return size_min;
+      }
+      return 1ULL << (lo + get_random_u32_below(hi - lo + 1));
+    case PCDEV_SIZE_FIXED:
+    default:
+      return size_min;
+  }
+}
+
+// The platform core keeps its own copy of the platform data, only the serial
+// number string has to outlive the registration
+static struct platform_device* pcdev_register(unsigned int idx, int id, const char* serial, u64* latency_ns)
+{
+  struct pcdev_platform_data pdata = {
+    .size = pcdev_pick_size(),
+    .perm = pcdev_perms[idx % ARRAY_SIZE(pcdev_perms)],
+    .serial_num = serial,
+  };
+  struct platform_device_info info = {
+    .name = pcdev_names[idx % ARRAY_SIZE(pcdev_names)],
+    .id = id,
+    .data = &pdata,
+    .size_data = sizeof(pdata),
+  };
+  struct platform_device* pdev;
+  ktime_t start;
+
+  start = ktime_get();
+  pdev = platform_device_register_full(&info);
+  *latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+  return pdev;
+}
+
+static void pcdev_unregister(struct platform_device* pdev, u64* latency_ns)
+{
+  ktime_t start;
+
+  start = ktime_get();
+  platform_device_unregister(pdev);
+  *latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 }
 
-static void pcdev_release(void)
+static int pcdev_latency_alloc(struct pcdev_latency* lat, unsigned int nr)
 {
-  pr_info("Device released\n");
+  lat->nr = 0;
+  lat->samples = kvmalloc_array(max(nr, 1U), sizeof(*lat->samples), GFP_KERNEL);
+
+  return lat->samples ? 0 : -ENOMEM;
+}
+
+static int pcdev_cmp_u64(const void* a, const void* b)
+{
+  u64 x = *(const u64*)a;
+  u64 y = *(const u64*)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static u64 pcdev_percentile(const struct pcdev_latency* lat, unsigned int pct)
+{
+  return lat->samples[(u64)(lat->nr - 1) * pct / 100];
+}
+
+static void pcdev_latency_report(const char* what, struct pcdev_latency* lat)
+{
+  if (!lat->nr) {
+    return;
+  }
+
+  sort(lat->samples, lat->nr, sizeof(*lat->samples), pcdev_cmp_u64, NULL);
+
+  pr_info("%s latency over %u devices: p50 %llu us, p90 %llu us, p99 %llu us, max %llu us\n", what, lat->nr,
+          div_u64(pcdev_percentile(lat, 50), NSEC_PER_USEC), div_u64(pcdev_percentile(lat, 90), NSEC_PER_USEC),
+          div_u64(pcdev_percentile(lat, 99), NSEC_PER_USEC), div_u64(lat->samples[lat->nr - 1], NSEC_PER_USEC));
+}
+
+// RAM in use system wide, good enough to see the growth at thousands of devices
+static long pcdev_used_kb(void)
+{
+  struct sysinfo si;
+
+  si_meminfo(&si);
+
+  // si_meminfo() reports in pages
+  return (si.totalram - si.freeram) << (PAGE_SHIFT - 10);
+}
+
+static int pcdev_stress_fn(void* data)
+{
+  struct pcdev_stress_worker* worker = data;
+  struct platform_device* pdev;
+  char serial[PCDEV_SERIAL_LEN];
+  unsigned int i;
+
+  for (i = 0; i < stress_iters; i++) {
+    snprintf(serial, sizeof(serial), "pcdevs%02u%06u", worker->id % 100, i % 1000000);
+
+    pdev = pcdev_register(worker->id + i, PLATFORM_DEVID_AUTO, serial,
+                          &worker->probe.samples[worker->probe.nr]);
+    if (IS_ERR(pdev)) {
+      worker->ret = PTR_ERR(pdev);
+      break;
+    }
+    worker->probe.nr++;
+
+    pcdev_unregister(pdev, &worker->remove.samples[worker->remove.nr++]);
+
+    cond_resched();
+  }
+
+  complete(&worker->done);
+
+  return 0;
+}
+
+// Runs stress_threads workers that each register and unregister a device
+// stress_iters times, all at once, then reports the merged latencies
+static int pcdev_stress(void)
+{
+  struct pcdev_stress_worker* workers;
+  struct pcdev_latency probe;
+  struct pcdev_latency remove;
+  struct task_struct* task;
+  unsigned int started = 0;
+  unsigned int i;
+  long used_kb;
+  int ret = 0;
+
+  workers = kcalloc(stress_threads, sizeof(*workers), GFP_KERNEL);
+  if (!workers) {
+    return -ENOMEM;
+  }
+
+  for (i = 0; i < stress_threads; i++) {
+    workers[i].id = i;
+    init_completion(&workers[i].done);
+    if (pcdev_latency_alloc(&workers[i].probe, stress_iters) ||
+        pcdev_latency_alloc(&workers[i].remove, stress_iters)) {
+      ret = -ENOMEM;
+      goto free_workers;
+    }
+  }
+
+  used_kb = pcdev_used_kb();
+
+  for (i = 0; i < stress_threads; i++) {
+    task = kthread_run(pcdev_stress_fn, &workers[i], "pcd_stress/%u", i);
+    if (IS_ERR(task)) {
+      ret = PTR_ERR(task);
+      break;
+    }
+    started++;
+  }
+
+  for (i = 0; i < started; i++) {
+    wait_for_completion(&workers[i].done);
+    if (workers[i].ret && !ret) {
+      ret = workers[i].ret;
+    }
+  }
+
+  if (ret) {
+    pr_err("Stress run failed: %d\n", ret);
+    goto free_workers;
+  }
+
+  if (pcdev_latency_alloc(&probe, stress_threads * stress_iters) ||
+      pcdev_latency_alloc(&remove, stress_threads * stress_iters)) {
+    kvfree(probe.samples);
+    ret = -ENOMEM;
+    goto free_workers;
+  }
+
+  for (i = 0; i < stress_threads; i++) {
+    memcpy(probe.samples + probe.nr, workers[i].probe.samples, workers[i].probe.nr * sizeof(u64));
+    probe.nr += workers[i].probe.nr;
+    memcpy(remove.samples + remove.nr, workers[i].remove.samples, workers[i].remove.nr * sizeof(u64));
+    remove.nr += workers[i].remove.nr;
+  }
+
+  pr_info("Stress: %u threads x %u add/remove cycles\n", stress_threads, stress_iters);
+  pcdev_latency_report("Stress probe", &probe);
+  pcdev_latency_report("Stress remove", &remove);
+  // Everything was removed again, anything left over is a leak or cache growth
+  pr_info("Stress memory growth %ld kB\n", pcdev_used_kb() - used_kb);
+
+  kvfree(remove.samples);
+  kvfree(probe.samples);
+
+free_workers:
+  for (i = 0; i < stress_threads; i++) {
+    kvfree(workers[i].remove.samples);
+    kvfree(workers[i].probe.samples);
+  }
+  kfree(workers);
+
+  return ret;
+}
+
+static void pcdev_unregister_all(struct pcdev_latency* lat)
+{
+  u64 latency_ns;
+
+  while (nr_pcdevs) {
+    nr_pcdevs--;
+    pcdev_unregister(pcdevs[nr_pcdevs], &latency_ns);
+    if (lat) {
+      lat->samples[lat->nr++] = latency_ns;
+    }
+  }
+
+  kvfree(pcdevs);
+  kvfree(pcdev_serials);
 }
 
 static int __init platform_pcdev_init(void)
 {
-  platform_add_devices(platform_pcdevs, ARRAY_SIZE(platform_pcdevs));
+  struct pcdev_latency probe;
+  struct platform_device* pdev;
+  long used_kb;
+  int ret;
+
+  ret = pcdev_parse_size_dist();
+  if (ret) {
+    return ret;
+  }
+
+  pcdevs = kvcalloc(max(count, 1U), sizeof(*pcdevs), GFP_KERNEL);
+  pcdev_serials = kvcalloc(max(count, 1U), sizeof(*pcdev_serials), GFP_KERNEL);
+  if (!pcdevs || !pcdev_serials || pcdev_latency_alloc(&probe, count)) {
+    kvfree(pcdev_serials);
+    kvfree(pcdevs);
+    return -ENOMEM;
+  }
+
+  used_kb = pcdev_used_kb();
+
+  for (nr_pcdevs = 0; nr_pcdevs < count; nr_pcdevs++) {
+    snprintf(pcdev_serials[nr_pcdevs], PCDEV_SERIAL_LEN, "pcdev%08u", nr_pcdevs);
+
+    pdev = pcdev_register(nr_pcdevs, nr_pcdevs, pcdev_serials[nr_pcdevs], &probe.samples[probe.nr]);
+    if (IS_ERR(pdev)) {
+      ret = PTR_ERR(pdev);
+      pr_err("Registering device %u failed: %d\n", nr_pcdevs, ret);
+      goto unregister;
+    }
+    pcdevs[nr_pcdevs] = pdev;
+    probe.nr++;
+  }
+
+  if (count) {
+    pcdev_latency_report("Probe", &probe);
+    pr_info("Memory growth %ld kB for %u devices\n", pcdev_used_kb() - used_kb, count);
+  }
+  kvfree(probe.samples);
+
+  if (stress_threads) {
+    ret = pcdev_stress();
+    if (ret) {
+      goto unregister_all;
+    }
+  }
 
   pr_info("Device setup module loaded\n");
 
   return 0;
+
+unregister:
+  kvfree(probe.samples);
+unregister_all:
+  pcdev_unregister_all(NULL);
+  return ret;
 }
 
 static void __exit platform_pcdev_exit(void)
 {
-  platform_device_unregister(&platform_pcdev_1);
-  platform_device_unregister(&platform_pcdev_2);
-  platform_device_unregister(&platform_pcdev_3);
-  platform_device_unregister(&platform_pcdev_4);
+  struct pcdev_latency remove;
+
+  if (pcdev_latency_alloc(&remove, nr_pcdevs)) {
+    pcdev_unregister_all(NULL);
+  } else {
+    pcdev_unregister_all(&remove);
+    pcdev_latency_report("Remove", &remove);
+    kvfree(remove.samples);
+  }
 
   pr_info("Device setup module unloaded\n");
 }
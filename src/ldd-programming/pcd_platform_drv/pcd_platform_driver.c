@@ -177,7 +177,7 @@ static int pcd_platform_driver_probe(struct platform_device* pdev)
   dev_set_drvdata(pdev->dev, dev_data);
 
   pr_info("Device serial number = %s\n", dev_data->pdata.serial_num);
-  pr_info("Device size = %d\n", dev_data->pdata.size);
+  pr_info("Device size = %llu\n", dev_data->pdata.size);
   pr_info("Device permission = %d\n", dev_data->pdata.perm);
 
   pr_info("Config item 1 = %d\n", pcdev_config[pdev->id_entry->driver_data].config_item1);
@@ -0,0 +1,96 @@
+#!/bin/sh
+# Times insmod of the pcd DT platform driver until every pcdev node is ready.
+#
+# For each device count an overlay with that many pcdev nodes is generated,
+# compiled and applied through the configfs overlay interface (needs
+# CONFIG_OF_OVERLAY and OF_CONFIGFS), then the driver is loaded both with
+# parallel (default) and synchronous probing. A run that hasn't seen all of its
+# devices after TIMEOUT seconds (default 60) fails.
+#
+#   ./bench_probe.sh ./pcd_platform_driver_dt.ko 10 100 1000
+
+set -e
+
+MODULE=${1:?usage: $0 <pcd_platform_driver_dt.ko> [count...]}
+shift
+COUNTS=${*:-10 100 1000}
+TIMEOUT=${TIMEOUT:-60}
+
+OVERLAYS=/sys/kernel/config/device-tree/overlays
+MODNAME=$(basename "$MODULE" .ko)
+WORKDIR=$(mktemp -d)
+trap 'rmdir "$OVERLAYS/pcd-bench" 2>/dev/null; rm -rf "$WORKDIR"' EXIT
+
+now_ns() {
+  date +%s%N
+}
+
+gen_overlay() {
+  count=$1
+  dts=$WORKDIR/pcd-bench-$count.dts
+
+  {
+    echo "/dts-v1/;"
+    echo "/plugin/;"
+    echo "/ {"
+    echo "  fragment@0 {"
+    echo "    target-path = \"/\";"
+    echo "    __overlay__ {"
+    i=0
+    while [ "$i" -lt "$count" ]; do
+      echo "      pcdev-bench-$i {"
+      echo "        compatible = \"pcdev-A1x\";"
+      echo "        org,size = <512>;"
+      echo "        org,device-serial-num = \"PCDEVBENCH$i\";"
+      echo "        org,perm = <0x11>;"
+      echo "      };"
+      i=$((i + 1))
+    done
+    echo "    };"
+    echo "  };"
+    echo "};"
+  } > "$dts"
+
+  dtc -@ -I dts -O dtb -o "$WORKDIR/pcd-bench-$count.dtbo" "$dts"
+}
+
+# Class devices of the overlay's nodes only, /dev/pcdev-N is numbered by minor and
+# says nothing about which node it belongs to
+ready_count() {
+  ls -l /sys/class/pcd_class/ 2>/dev/null | grep -c '/pcdev-bench-[0-9]*/pcd_class/' || true
+}
+
+# Prints the microseconds from insmod until 'count' device nodes exist
+time_insmod() {
+  count=$1
+  shift
+
+  start=$(now_ns)
+  deadline=$((start + TIMEOUT * 1000000000))
+  insmod "$MODULE" "$@"
+  while [ "$(ready_count)" -lt "$count" ]; do
+    if [ "$(now_ns)" -gt "$deadline" ]; then
+      echo "Only $(ready_count) of $count devices probed after ${TIMEOUT}s" >&2
+      rmmod "$MODNAME"
+      exit 1
+    fi
+  done
+  end=$(now_ns)
+
+  rmmod "$MODNAME"
+  echo $(((end - start) / 1000))
+}
+
+for count in $COUNTS; do
+  gen_overlay "$count"
+
+  mkdir "$OVERLAYS/pcd-bench"
+  cat "$WORKDIR/pcd-bench-$count.dtbo" > "$OVERLAYS/pcd-bench/dtbo"
+
+  async_us=$(time_insmod "$count")
+  sync_us=$(time_insmod "$count" sync_probe=1)
+
+  rmdir "$OVERLAYS/pcd-bench"
+
+  printf "%6d devices: parallel %10d us, synchronous %10d us\n" "$count" "$async_us" "$sync_us"
+done
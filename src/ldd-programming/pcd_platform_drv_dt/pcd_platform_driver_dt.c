@@ -9,13 +9,28 @@
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/idr.h>
+#include <linux/xarray.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/dma-mapping.h>
+#include <linux/io.h>
+#include <linux/notifier.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
 #include <platform.h>
 
 // Format every pr_* message with the current running function name
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt,__func__
 
-#define MAX_DEVICES 10
+// Minors are handed out from an IDA and made reachable through the VFS in regions of
+// this many minors under a single major, registered on demand as devices show up
+#define PCD_MINORS_PER_REGION 256
+
+// Lets the probe benchmark compare against the old synchronous behaviour
+static bool sync_probe;
+module_param(sync_probe, bool, 0444);
+MODULE_PARM_DESC(sync_probe, "Probe devices synchronously instead of in parallel");
 
 static int pcd_open(struct inode* inod, struct file* filp);
 static int pcd_release(struct inode* inod, struct file* filp);
@@ -25,11 +40,16 @@ static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence);
 static int pcd_platform_driver_probe(struct platform_device* pdev);
 static int pcd_platform_driver_remove(struct platform_device* pdev);
 
+static struct notifier_block pcd_of_nb;
+// Applies overlay property changes outside the OF reconfig notifier chain, in order
+static struct workqueue_struct* pcd_of_wq;
+
 static const struct file_operations pcd_fops = {
   .open = pcd_open,
   .release = pcd_release,
   .read = pcd_read,
   .write = pcd_write,
+  .llseek = pcd_lseek,
   .owner = THIS_MODULE,
 };
 
@@ -78,33 +98,73 @@ struct of_device_id org_pcdev_dt_match[] = {
   { .compatible = "pcdev-D1x", .data = (void*)PCDEVD1X },
 };
 
-static const struct platform_driver pcd_platform_driver = {
+static struct platform_driver pcd_platform_driver = {
   .probe = pcd_platform_driver_probe,
   .remove = pcd_platform_driver_remove,
   .id_table = pcdevs_ids,
   .driver = {
     .name = "pseudo-char-device",
     .of_match_table = of_match_ptr(org_pcdev_dt_match),
+    // Every probe only touches its own device, so let the driver core run them
+    // in parallel instead of serially during boot/insmod
+    .probe_type = PROBE_PREFER_ASYNCHRONOUS,
   },
 };
 
 // Driver private data structure
 static const struct pcdrv_private_data {
-  int total_devices;
   dev_t device_num_base;
   struct class* pcd_class;
-  struct device* pcd_dev;
+  struct ida minor_ida;
+  struct xarray devices; // minor -> struct pcdev_private_data*
+  struct xarray regions; // region index -> struct cdev* covering its minors
+  struct xarray carveouts; // base PFN -> struct device* using that carve-out
+  unsigned int nr_regions;
+  struct mutex region_lock;
 };
 
-// Device private data structure
+// Where a device buffer lives, which decides how it can be resized
+enum pcdev_backing {
+  PCDEV_BACKING_KMALLOC,
+  PCDEV_BACKING_DMA,      // shared-dma-pool / CMA memory-region, allocated in full
+  PCDEV_BACKING_CARVEOUT, // plain reserved memory-region, mapped in full
+};
+
+// Device private data structure. Open files hold a reference, so it outlives the
+// platform device; its devm managed buffer doesn't, which is what gone is for.
 static const struct pcdev_private_data {
+  struct kref ref;
+  bool gone; // Removed, under lock
   struct pcdev_platform_data pdata;
   char *buf;
   dev_t device_num;
-  struct cdev chdev;
+  struct device* pcd_dev;
+  struct mutex lock; // Protects buf and pdata against live reconfiguration
+  enum pcdev_backing backing;
+  dma_addr_t dma_handle;
+  size_t region_size; // Upper bound for memory-region backed devices
+};
+
+struct pcdrv_private_data pcdrv_data = {
+  .minor_ida = IDA_INIT(pcdrv_data.minor_ida),
+  .devices = XARRAY_INIT(pcdrv_data.devices, 0),
+  .regions = XARRAY_INIT(pcdrv_data.regions, 0),
+  .carveouts = XARRAY_INIT(pcdrv_data.carveouts, 0),
+  .region_lock = __MUTEX_INITIALIZER(pcdrv_data.region_lock),
 };
 
-struct pcdrv_private_data pcdrv_data;
+static void pcdev_free(struct kref* ref)
+{
+  kfree(container_of(ref, struct pcdev_private_data, ref));
+}
+
+// Drops the reference of the bound device, once devres runs after remove
+static void pcdev_put(void* data)
+{
+  struct pcdev_private_data* dev_data = data;
+
+  kref_put(&dev_data->ref, pcdev_free);
+}
 
 static int check_permission(int dev_perm, int access_mode)
 {
@@ -123,11 +183,84 @@ static int check_permission(int dev_perm, int access_mode)
   return -EPERM;
 }
 
+// Makes every minor below (region + 1) * PCD_MINORS_PER_REGION reachable. One cdev
+// covers a whole region; pcd_open finds the actual device through the xarray.
+static int pcd_regions_grow(unsigned int region)
+{
+  struct cdev* cdev;
+  dev_t base;
+  int ret = 0;
+
+  mutex_lock(&pcdrv_data.region_lock);
+
+  while (pcdrv_data.nr_regions <= region) {
+    base = MKDEV(MAJOR(pcdrv_data.device_num_base), pcdrv_data.nr_regions * PCD_MINORS_PER_REGION);
+
+    // Region 0 was reserved at init, which is also how we got our major
+    if (pcdrv_data.nr_regions) {
+      ret = register_chrdev_region(base, PCD_MINORS_PER_REGION, "pcdevs");
+      if (ret) {
+        break;
+      }
+    }
+
+    cdev = cdev_alloc();
+    if (!cdev) {
+      ret = -ENOMEM;
+      goto unreg_region;
+    }
+    cdev->ops = &pcd_fops;
+    cdev->owner = THIS_MODULE;
+
+    ret = xa_err(xa_store(&pcdrv_data.regions, pcdrv_data.nr_regions, cdev, GFP_KERNEL));
+    if (ret) {
+      kobject_put(&cdev->kobj);
+      goto unreg_region;
+    }
+
+    ret = cdev_add(cdev, base, PCD_MINORS_PER_REGION);
+    if (ret) {
+      xa_erase(&pcdrv_data.regions, pcdrv_data.nr_regions);
+      kobject_put(&cdev->kobj);
+      goto unreg_region;
+    }
+
+    pcdrv_data.nr_regions++;
+  }
+
+  mutex_unlock(&pcdrv_data.region_lock);
+
+  return ret;
+
+unreg_region:
+  if (pcdrv_data.nr_regions) {
+    unregister_chrdev_region(base, PCD_MINORS_PER_REGION);
+  }
+  mutex_unlock(&pcdrv_data.region_lock);
+  return ret;
+}
+
+static void pcd_regions_destroy(void)
+{
+  struct cdev* cdev;
+  unsigned long region;
+
+  xa_for_each(&pcdrv_data.regions, region, cdev) {
+    cdev_del(cdev);
+  }
+  xa_destroy(&pcdrv_data.regions);
+
+  for (region = 1; region < pcdrv_data.nr_regions; region++) {
+    unregister_chrdev_region(MKDEV(MAJOR(pcdrv_data.device_num_base), region * PCD_MINORS_PER_REGION), PCD_MINORS_PER_REGION);
+  }
+  unregister_chrdev_region(pcdrv_data.device_num_base, PCD_MINORS_PER_REGION);
+}
+
 static int __init pcd_platform_driver_init(void)
 {
   int ret;
 
-  ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, MAX_DEVICES, "pcdevs");
+  ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, PCD_MINORS_PER_REGION, "pcdevs");
   if (ret < 0) {
     pr_err("Alloc chrdev region failed\n");
     return ret;
@@ -140,8 +273,23 @@ static int __init pcd_platform_driver_init(void)
     return ret;
   }
 
+  pcd_of_wq = alloc_ordered_workqueue("pcd_of", 0);
+  if (!pcd_of_wq) {
+    class_destroy(pcdrv_data.pcd_class);
+    unregister_chrdev_region(pcdrv_data.device_num_base, PCD_MINORS_PER_REGION);
+    return -ENOMEM;
+  }
+
+  if (sync_probe) {
+    pcd_platform_driver.driver.probe_type = PROBE_FORCE_SYNCHRONOUS;
+  }
+
   platform_driver_register(&pcd_platform_driver);
 
+  if (IS_ENABLED(CONFIG_OF_DYNAMIC)) {
+    of_reconfig_notifier_register(&pcd_of_nb);
+  }
+
   pr_info("Pcd platform driver loaded\n");
 
   return 0;
@@ -149,17 +297,26 @@ static int __init pcd_platform_driver_init(void)
 
 static void __exit pcd_platform_driver_exit(void)
 {
+  if (IS_ENABLED(CONFIG_OF_DYNAMIC)) {
+    of_reconfig_notifier_unregister(&pcd_of_nb);
+  }
+  // Runs the updates still queued, they hold references on their devices
+  destroy_workqueue(pcd_of_wq);
   platform_driver_unregister(&pcd_platform_driver);
   class_destroy(pcdrv_data.pcd_class);
-  unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
+  pcd_regions_destroy();
+  ida_destroy(&pcdrv_data.minor_ida);
+  xa_destroy(&pcdrv_data.devices);
 
   pr_info("Pcd platform driver unloaded\n");
 }
 
-static pcdev_platform_data* pcdev_get_platdata_from_dt(struct device* dev)
+static struct pcdev_platform_data* pcdev_get_platdata_from_dt(struct device* dev)
 {
   struct device_node* dev_node = dev->of_node;
   struct pcdev_platform_data* pdata;
+  u32 size32;
+  int len;
 
   if (!dev_node) {
     // This probe didn't happen because of device tree node
@@ -177,11 +334,23 @@ static pcdev_platform_data* pcdev_get_platdata_from_dt(struct device* dev)
     return ERR_PTR(-EINVAL);
   }
 
-  if (of_property_read_u32(dev_node, "org,size", &pdata->size)) {
+  // org,size is a single cell, or /bits/ 64 for devices of 4 GB and up
+  if (!of_find_property(dev_node, "org,size", &len)) {
     dev_info(dev, "Missing size property\n");
     return ERR_PTR(-EINVAL);
   }
 
+  if (len == sizeof(u64)) {
+    if (of_property_read_u64(dev_node, "org,size", &pdata->size)) {
+      return ERR_PTR(-EINVAL);
+    }
+  } else {
+    if (of_property_read_u32(dev_node, "org,size", &size32)) {
+      return ERR_PTR(-EINVAL);
+    }
+    pdata->size = size32;
+  }
+
   if (of_property_read_u32(dev_node, "org,perm", &pdata->perm)) {
     dev_info(dev, "Missing permission property\n");
     return ERR_PTR(-EINVAL);
@@ -190,7 +359,302 @@ static pcdev_platform_data* pcdev_get_platdata_from_dt(struct device* dev)
   return pdata;
 }
 
-// Called when matched platform device is found
+static void pcdev_release_rmem(void* data)
+{
+  of_reserved_mem_device_release(data);
+}
+
+static void pcdev_release_carveout(void* data)
+{
+  struct reserved_mem* rmem = data;
+
+  xa_erase(&pcdrv_data.carveouts, PHYS_PFN(rmem->base));
+}
+
+// A carve-out is mapped in full for one device, a second one would silently
+// share its buffer
+static int pcdev_claim_carveout(struct device* dev, struct reserved_mem* rmem)
+{
+  int ret;
+
+  ret = xa_insert(&pcdrv_data.carveouts, PHYS_PFN(rmem->base), dev, GFP_KERNEL);
+  if (ret == -EBUSY) {
+    dev_err(dev, "memory-region %s is already used by another device\n", rmem->name);
+  }
+  if (ret) {
+    return ret;
+  }
+
+  return devm_add_action_or_reset(dev, pcdev_release_carveout, rmem);
+}
+
+// Devices whose DT node has a memory-region are backed by that reserved memory,
+// physically contiguous and as aligned as the region is, so large buffers
+// neither hit kmalloc limits nor fragment the page allocator. shared-dma-pool
+// regions (CMA when marked reusable) are allocated from through the DMA API,
+// plain carve-outs are mapped directly. Everything else uses devm_kzalloc.
+static int pcdev_alloc_buffer(struct device* dev, struct pcdev_private_data* dev_data)
+{
+  u64 size = dev_data->pdata.size;
+  struct device_node* rmem_node = NULL;
+  struct reserved_mem* rmem;
+  bool dma_pool;
+  int ret;
+
+  if (size > SIZE_MAX) {
+    dev_err(dev, "Size %llu does not fit in the address space\n", size);
+    return -E2BIG;
+  }
+
+  if (dev->of_node) {
+    rmem_node = of_parse_phandle(dev->of_node, "memory-region", 0);
+  }
+
+  if (!rmem_node) {
+    if (size > KMALLOC_MAX_SIZE) {
+      dev_err(dev, "Size %llu needs a memory-region\n", size);
+      return -E2BIG;
+    }
+    dev_data->backing = PCDEV_BACKING_KMALLOC;
+    dev_data->buf = devm_kzalloc(dev, size, GFP_KERNEL);
+    return dev_data->buf ? 0 : -ENOMEM;
+  }
+
+  rmem = of_reserved_mem_lookup(rmem_node);
+  // The DMA core owns shared-dma-pool regions (CMA when reusable), they must
+  // only be reached through the DMA API
+  dma_pool = of_device_is_compatible(rmem_node, "shared-dma-pool");
+  of_node_put(rmem_node);
+  if (!rmem) {
+    dev_err(dev, "memory-region is not a reserved-memory node\n");
+    return -EINVAL;
+  }
+
+  if (size > rmem->size) {
+    dev_err(dev, "Size %llu exceeds memory-region %s (%pa bytes)\n", size, rmem->name, &rmem->size);
+    return -EINVAL;
+  }
+
+  dev_data->region_size = rmem->size;
+
+  if (dma_pool) {
+    ret = of_reserved_mem_device_init(dev);
+    if (ret) {
+      return dev_err_probe(dev, ret, "Cannot attach memory-region %s\n", rmem->name);
+    }
+
+    ret = devm_add_action_or_reset(dev, pcdev_release_rmem, dev);
+    if (ret) {
+      return ret;
+    }
+
+    // All of the pool, like a carve-out. Swapping in a buffer of the new size
+    // would need both at once, so a device over half the pool couldn't resize.
+    dev_data->backing = PCDEV_BACKING_DMA;
+    dev_data->buf = dmam_alloc_coherent(dev, rmem->size, &dev_data->dma_handle, GFP_KERNEL);
+    if (!dev_data->buf) {
+      return -ENOMEM;
+    }
+    dev_dbg(dev, "Buffer allocated from %s at %pad\n", rmem->name, &dev_data->dma_handle);
+  } else {
+    // A plain carve-out, used as is. All of it is mapped so that a later
+    // resize within the region is just a size change.
+    ret = pcdev_claim_carveout(dev, rmem);
+    if (ret) {
+      return ret;
+    }
+
+    dev_data->backing = PCDEV_BACKING_CARVEOUT;
+    dev_data->buf = devm_memremap(dev, rmem->base, rmem->size, MEMREMAP_WB);
+    if (IS_ERR(dev_data->buf)) {
+      ret = PTR_ERR(dev_data->buf);
+      dev_data->buf = NULL;
+      return ret;
+    }
+    memset(dev_data->buf, 0, size);
+    dev_dbg(dev, "Buffer mapped from %s at %pa\n", rmem->name, &rmem->base);
+  }
+
+  return 0;
+}
+
+// Resizes the buffer keeping its contents, with dev_data->lock held
+static int pcdev_resize_buffer(struct device* dev, struct pcdev_private_data* dev_data, u64 size)
+{
+  size_t old_size = dev_data->pdata.size;
+  char* buf;
+
+  if (size > SIZE_MAX || !size) {
+    return -EINVAL;
+  }
+
+  switch (dev_data->backing) {
+    case PCDEV_BACKING_KMALLOC:
+      if (size > KMALLOC_MAX_SIZE) {
+        return -E2BIG;
+      }
+      buf = devm_krealloc(dev, dev_data->buf, size, GFP_KERNEL);
+      if (!buf) {
+        return -ENOMEM;
+      }
+      break;
+    case PCDEV_BACKING_DMA:
+    case PCDEV_BACKING_CARVEOUT:
+      if (size > dev_data->region_size) {
+        return -E2BIG;
+      }
+      buf = dev_data->buf;
+      break;
+    default:
+      return -EINVAL;
+  }
+
+  // Whatever is past the old end may be stale from an earlier shrink
+  if (size > old_size) {
+    memset(buf + old_size, 0, size - old_size);
+  }
+
+  dev_data->buf = buf;
+  dev_data->pdata.size = size;
+
+  return 0;
+}
+
+// Applies a changed org,* property to a bound device in place. Open files keep
+// working and the buffer contents survive, so a DT overlay that only tunes
+// size, permission or serial number doesn't cost a remove/probe cycle.
+static int pcdev_update_property(struct device* dev, struct pcdev_private_data* dev_data, struct property* prop)
+{
+  const char* serial;
+  u64 size;
+  int ret = 0;
+
+  mutex_lock(&dev_data->lock);
+
+  if (!strcmp(prop->name, "org,size")) {
+    if (prop->length == sizeof(u64)) {
+      size = be64_to_cpup(prop->value);
+    } else if (prop->length == sizeof(u32)) {
+      size = be32_to_cpup(prop->value);
+    } else {
+      ret = -EINVAL;
+      goto out;
+    }
+    ret = pcdev_resize_buffer(dev, dev_data, size);
+  } else if (!strcmp(prop->name, "org,perm")) {
+    if (prop->length != sizeof(u32)) {
+      ret = -EINVAL;
+      goto out;
+    }
+    // Only affects future opens, existing fds keep the access they were granted
+    dev_data->pdata.perm = be32_to_cpup(prop->value);
+  } else if (!strcmp(prop->name, "org,device-serial-num")) {
+    serial = devm_kstrndup(dev, prop->value, prop->length, GFP_KERNEL);
+    if (!serial) {
+      ret = -ENOMEM;
+      goto out;
+    }
+    devm_kfree(dev, dev_data->pdata.serial_num);
+    dev_data->pdata.serial_num = serial;
+  }
+
+out:
+  mutex_unlock(&dev_data->lock);
+
+  if (ret) {
+    dev_err(dev, "Failed to apply %s: %d\n", prop->name, ret);
+  } else {
+    dev_dbg(dev, "Applied %s\n", prop->name);
+  }
+
+  return ret;
+}
+
+// A property change copied out of the notifier, the property itself may be gone
+// by the time the work runs
+struct pcd_of_update {
+  struct work_struct work;
+  struct platform_device* pdev; // Reference dropped by the work
+  struct property prop;
+};
+
+static void pcd_of_update_free(struct pcd_of_update* upd)
+{
+  kfree(upd->prop.value);
+  kfree(upd->prop.name);
+  kfree(upd);
+}
+
+static void pcd_of_update_work(struct work_struct* work)
+{
+  struct pcd_of_update* upd = container_of(work, struct pcd_of_update, work);
+  struct platform_device* pdev = upd->pdev;
+  struct pcdev_private_data* dev_data;
+
+  // Keeps probe and remove away while the update is applied
+  device_lock(&pdev->dev);
+  if (pdev->dev.driver == &pcd_platform_driver.driver) {
+    dev_data = platform_get_drvdata(pdev);
+    if (dev_data) {
+      pcdev_update_property(&pdev->dev, dev_data, &upd->prop);
+    }
+  }
+  device_unlock(&pdev->dev);
+
+  put_device(&pdev->dev);
+  pcd_of_update_free(upd);
+}
+
+// Runs with of_mutex held. A probe holding the device lock can reach OF code
+// that wants of_mutex, so the device lock is only taken later, from the work.
+static int pcd_of_notify(struct notifier_block* nb, unsigned long action, void* arg)
+{
+  struct of_reconfig_data* rd = arg;
+  struct platform_device* pdev;
+  struct pcd_of_update* upd;
+
+  // Node additions, removals and status changes are handled by the driver core
+  if (action != OF_RECONFIG_UPDATE_PROPERTY && action != OF_RECONFIG_ADD_PROPERTY) {
+    return NOTIFY_DONE;
+  }
+
+  pdev = of_find_device_by_node(rd->dn);
+  if (!pdev) {
+    return NOTIFY_DONE;
+  }
+
+  upd = kzalloc(sizeof(*upd), GFP_KERNEL);
+  if (!upd) {
+    goto put_dev;
+  }
+
+  upd->prop.name = kstrdup(rd->prop->name, GFP_KERNEL);
+  upd->prop.value = kmemdup(rd->prop->value, rd->prop->length, GFP_KERNEL);
+  upd->prop.length = rd->prop->length;
+  if (!upd->prop.name || (rd->prop->length && !upd->prop.value)) {
+    pcd_of_update_free(upd);
+    goto put_dev;
+  }
+
+  upd->pdev = pdev;
+  INIT_WORK(&upd->work, pcd_of_update_work);
+  queue_work(pcd_of_wq, &upd->work);
+
+  return NOTIFY_OK;
+
+put_dev:
+  dev_err(&pdev->dev, "Cannot queue the update of %s\n", rd->prop->name);
+  put_device(&pdev->dev);
+  return NOTIFY_DONE;
+}
+
+static struct notifier_block pcd_of_nb = {
+  .notifier_call = pcd_of_notify,
+};
+
+// Called when matched platform device is found. May run concurrently with the
+// probes of other devices, so everything here is either per device or atomic,
+// and per device chatter goes to dev_dbg to keep the console lock out of the way.
 static int pcd_platform_driver_probe(struct platform_device* pdev)
 {
   struct device* dev = &pdev->dev;
@@ -198,9 +662,10 @@ static int pcd_platform_driver_probe(struct platform_device* pdev)
   struct pcdev_private_data* dev_data;
   struct pcdev_platform_data* pdata;
   int driver_data;
+  int minor;
   const struct of_device_id* match;
 
-  dev_info(dev, "A device is detected\n");
+  dev_dbg(dev, "A device is detected\n");
 
   // match will always be NULL if linux doesn't support device tree (CONFIG_OF is off)
   match = of_match_device(of_match_ptr(org_pcdev_dt_match), dev);
@@ -221,99 +686,249 @@ static int pcd_platform_driver_probe(struct platform_device* pdev)
     return -EINVAL;
   }
 
-  // Dynamically allocate memory for the device private data
-  dev_data = devm_kzalloc(dev, sizeof(*dev_data), GFP_KERNEL);
+  // Dynamically allocate memory for the device private data. Not devm, open
+  // files may still point at it after the device is gone.
+  dev_data = kzalloc(sizeof(*dev_data), GFP_KERNEL);
   if (!dev_data) {
     dev_info(dev, "Cannot allocate memory\n");
     return -ENOMEM;
   }
+  kref_init(&dev_data->ref);
+
+  ret = devm_add_action_or_reset(dev, pcdev_put, dev_data);
+  if (ret) {
+    return ret;
+  }
 
   // Save the device private data pointer in platform device structure
-  dev_set_drvdata(pdev->dev, dev_data);
+  dev_set_drvdata(dev, dev_data);
+
+  mutex_init(&dev_data->lock);
 
   dev_data->pdata.size = pdata->size;
   dev_data->pdata.perm = pdata->perm;
-  dev_data->pdata.serial_num = pdata->serial_num;
+  // Our own copy, a live reconfiguration may replace it
+  dev_data->pdata.serial_num = devm_kstrdup(dev, pdata->serial_num, GFP_KERNEL);
+  if (!dev_data->pdata.serial_num) {
+    return -ENOMEM;
+  }
 
-  dev_info(dev, "Device serial number = %s\n", dev_data->pdata.serial_num);
-  dev_info(dev, "Device size = %d\n", dev_data->pdata.size);
-  dev_info(dev, "Device permission = %d\n", dev_data->pdata.perm);
+  dev_dbg(dev, "Device serial number = %s\n", dev_data->pdata.serial_num);
+  dev_dbg(dev, "Device size = %llu\n", dev_data->pdata.size);
+  dev_dbg(dev, "Device permission = %d\n", dev_data->pdata.perm);
 
-  dev_info(dev, "Config item 1 = %d\n", pcdev_config[driver_data].config_item1);
-  dev_info(dev, "Config item 2 = %d\n", pcdev_config[driver_data].config_item2);
+  dev_dbg(dev, "Config item 1 = %d\n", pcdev_config[driver_data].config_item1);
+  dev_dbg(dev, "Config item 2 = %d\n", pcdev_config[driver_data].config_item2);
 
   // Dynamically allocate memory for the device buffer using
   // size information from the platform data
-  dev_data->buf = devm_kzalloc(dev, sizeof(dev_data->pdata.size), GFP_KERNEL);
-  if (!dev_data->buf) {
+  ret = pcdev_alloc_buffer(dev, dev_data);
+  if (ret) {
     dev_info(dev, "Cannot allocate memory\n");
-    return -ENOMEM;
+    return ret;
   }
 
-  // Get the device number
-  dev_data->device_num = pcdrv_data.device_num_base + pcdrv_data.total_devices;
-  
-  // Do cdev init and cdev add
-  cdev_init(&dev_data->chdev, &pcd_fops);
-  dev_data->chdev.owner = THIS_MODULE;
+  // Get the device number. The IDA hands back the lowest free minor, so minors
+  // released by remove are reused and regions only grow when all are in use.
+  minor = ida_alloc_max(&pcdrv_data.minor_ida, MINORMASK, GFP_KERNEL);
+  if (minor < 0) {
+    dev_err(dev, "No device numbers left\n");
+    return minor;
+  }
+  dev_data->device_num = MKDEV(MAJOR(pcdrv_data.device_num_base), minor);
 
-  ret = cdev_add(&dev_data->chdev, dev_data->device_num, 1);
-  if (ret < 0) {
+  ret = pcd_regions_grow(minor / PCD_MINORS_PER_REGION);
+  if (ret) {
     dev_err(dev, "Cdev add failed\n");
-    return ret;
+    goto free_minor;
+  }
+
+  ret = xa_insert(&pcdrv_data.devices, minor, dev_data, GFP_KERNEL);
+  if (ret) {
+    goto free_minor;
   }
 
   // Create device file for the detected platform device
-  pcdrv_data.pcd_device = device_create(pcdrv_data.pcd_class, dev, dev_data->device_num, NULL, "pcdev-%d", pcdrv_data.total_devices);
-  if (IS_ERR(pcdrv_data.pcd_dev)) {
+  dev_data->pcd_dev = device_create(pcdrv_data.pcd_class, dev, dev_data->device_num, NULL, "pcdev-%d", minor);
+  if (IS_ERR(dev_data->pcd_dev)) {
     dev_err(dev, "Device create failed\n");
-    ret = PTR_ERR(pcdrv_data.pcd_dev);
-    cdev_del(&dev_data->cdev);
-    return ret;
+    ret = PTR_ERR(dev_data->pcd_dev);
+    goto erase_minor;
   }
 
-  pcdrv_data.total_devices++;
-
-  dev_info(dev, "Probe was successful\n");
+  dev_dbg(dev, "Probe was successful\n");
 
   return 0;
+
+erase_minor:
+  xa_erase(&pcdrv_data.devices, minor);
+free_minor:
+  ida_free(&pcdrv_data.minor_ida, minor);
+  return ret;
 }
 
 // Called when the device is removed from the system
 static int pcd_platform_driver_remove(struct platform_device* pdev)
 {
   struct pcdev_private_data* dev_data = dev_get_drvdata(&pdev->dev);
+
   device_destroy(pcdrv_data.pcd_class, dev_data->device_num);
-  cdev_del(&dev_data->cdev);
-  pcdrv_data.total_devices--;
+  xa_erase(&pcdrv_data.devices, MINOR(dev_data->device_num));
+  ida_free(&pcdrv_data.minor_ida, MINOR(dev_data->device_num));
+
+  // The buffer goes away with the devres of pdev, files still open from now on
+  // get -ENODEV
+  mutex_lock(&dev_data->lock);
+  dev_data->gone = true;
+  mutex_unlock(&dev_data->lock);
 
-  dev_info(&pdev->dev, "Device removed\n");
+  dev_dbg(&pdev->dev, "Device removed\n");
 
   return 0;
 }
 
 static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
 {
-  return 0;
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+  loff_t max_size;
+  loff_t temp;
+
+  mutex_lock(&dev_data->lock);
+  if (dev_data->gone) {
+    mutex_unlock(&dev_data->lock);
+    return -ENODEV;
+  }
+  max_size = dev_data->pdata.size;
+  mutex_unlock(&dev_data->lock);
+
+  switch(whence) {
+    case SEEK_SET:
+      temp = offset;
+      break;
+    case SEEK_CUR:
+      temp = filp->f_pos + offset;
+      break;
+    case SEEK_END:
+      temp = max_size + offset;
+      break;
+    default:
+      return -EINVAL;
+  }
+
+  if (temp > max_size || temp < 0) {
+    return -EINVAL;
+  }
+  filp->f_pos = temp;
+
+  return filp->f_pos;
 }
 
+// The size is re-read under the lock on every call, so an fd stays usable
+// across live resizes and simply sees the new size.
 static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
 {
-  return 0;
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+
+  if (mutex_lock_interruptible(&dev_data->lock)) {
+    return -EINTR;
+  }
+
+  if (dev_data->gone) {
+    mutex_unlock(&dev_data->lock);
+    return -ENODEV;
+  }
+
+  if (*f_pos >= dev_data->pdata.size) {
+    count = 0;
+  } else if ((*f_pos + count) > dev_data->pdata.size) {
+    count = dev_data->pdata.size - *f_pos;
+  }
+
+  if (copy_to_user(buff, dev_data->buf + *f_pos, count)) {
+    mutex_unlock(&dev_data->lock);
+    return -EFAULT;
+  }
+
+  mutex_unlock(&dev_data->lock);
+
+  *f_pos += count;
+
+  return count;
 }
 
 static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
 {
-  return -ENOMEM;
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+
+  if (mutex_lock_interruptible(&dev_data->lock)) {
+    return -EINTR;
+  }
+
+  if (dev_data->gone) {
+    mutex_unlock(&dev_data->lock);
+    return -ENODEV;
+  }
+
+  if (*f_pos >= dev_data->pdata.size) {
+    count = 0;
+  } else if ((*f_pos + count) > dev_data->pdata.size) {
+    count = dev_data->pdata.size - *f_pos;
+  }
+
+  if (!count) {
+    mutex_unlock(&dev_data->lock);
+    dev_err(dev_data->pcd_dev, "No space left on the device\n");
+    return -ENOMEM;
+  }
+
+  if (copy_from_user(dev_data->buf + *f_pos, buff, count)) {
+    mutex_unlock(&dev_data->lock);
+    return -EFAULT;
+  }
+
+  mutex_unlock(&dev_data->lock);
+
+  *f_pos += count;
+
+  return count;
 }
 
 static int pcd_open(struct inode* inod, struct file* filp)
 {
+  struct pcdev_private_data* dev_data;
+
+  int ret;
+
+  // The region cdev is shared, so look the device up by minor. The reference is
+  // taken under xa_lock, remove erases the entry before it lets go of its own.
+  xa_lock(&pcdrv_data.devices);
+  dev_data = xa_load(&pcdrv_data.devices, MINOR(inod->i_rdev));
+  if (dev_data) {
+    kref_get(&dev_data->ref);
+  }
+  xa_unlock(&pcdrv_data.devices);
+
+  if (!dev_data) {
+    return -ENODEV;
+  }
+
+  ret = check_permission(dev_data->pdata.perm, filp->f_mode);
+  if (ret) {
+    kref_put(&dev_data->ref, pcdev_free);
+    return ret;
+  }
+
+  filp->private_data = dev_data;
+
   return 0;
 }
 
 static int pcd_release(struct inode* inod, struct file* filp)
 {
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+
+  kref_put(&dev_data->ref, pcdev_free);
+
   return 0;
 }
 
@@ -1,14 +1,16 @@
 #ifndef PLATFORM_DATA_H
 #define PLATFORM_DATA_H
 
+#include <linux/types.h>
+
 #define RDONLY 0x01
 #define WRONLY 0x10
 #define RDWR 0x11
 
 struct pcdev_platform_data {
-  int size;
+  u64 size;
   int perm;
   const char* serial_num;
-}
+};
 
 #endif // PLATFORM_DATA_H
@@ -0,0 +1,279 @@
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+
+struct pcd_buf* pcd_buf_alloc(size_t size)
+{
+  struct pcd_buf* buf;
+  unsigned long i;
+
+  buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+  if (!buf) {
+    return NULL;
+  }
+
+  buf->size = size;
+  buf->nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+  buf->pages = kvcalloc(buf->nr_pages, sizeof(*buf->pages), GFP_KERNEL);
+  buf->zpages = kvcalloc(buf->nr_pages, sizeof(*buf->zpages), GFP_KERNEL);
+  if (!buf->pages || !buf->zpages) {
+    kvfree(buf->zpages);
+    kvfree(buf->pages);
+    kfree(buf);
+    return NULL;
+  }
+
+  for (i = 0; i < buf->nr_pages; i++) {
+    buf->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!buf->pages[i]) {
+      pcd_buf_free(buf);
+      return NULL;
+    }
+  }
+
+  return buf;
+}
+
+// Drops this buffer's reference on its pages. Pages still shared with a newer
+// pcd_buf (or mapped somewhere) stay alive until their last user goes away.
+// Compressed copies of reclaimed pages are never shared and go with the buffer.
+void pcd_buf_free(struct pcd_buf* buf)
+{
+  unsigned long i;
+
+  if (!buf) {
+    return;
+  }
+
+  for (i = 0; i < buf->nr_pages; i++) {
+    if (buf->pages[i]) {
+      put_page(buf->pages[i]);
+    }
+  }
+
+  pcd_reclaim_free(buf);
+  kvfree(buf->zpages);
+  kvfree(buf->pages);
+  kfree(buf);
+}
+
+// Resizes the device without stopping I/O. The new pcd_buf is built on the side:
+// it shares every page the old and new sizes have in common, so a grow only
+// allocates the added pages and a shrink allocates none, and no data is copied.
+// Readers and writers that already picked up the old buffer finish against it;
+// it is released once they have all left their SRCU read sections. The next
+// resize waits for that too: until then a writer on a buffer from before a
+// shrink can still store past the new end, where a grow would clear.
+// resize_lock can't be held across the grace period, SRCU readers take it to
+// fault reclaimed pages back in, hence resize_gp_lock.
+int pcd_buf_resize(struct pcdev_private_data* dev_data, size_t size)
+{
+  struct pcd_buf* old;
+  struct pcd_buf* new;
+  struct page* page;
+  unsigned long shared;
+  unsigned long i;
+  size_t tail;
+
+  new = kzalloc(sizeof(*new), GFP_KERNEL);
+  if (!new) {
+    return -ENOMEM;
+  }
+
+  new->size = size;
+  new->nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+  new->pages = kvcalloc(new->nr_pages, sizeof(*new->pages), GFP_KERNEL);
+  new->zpages = kvcalloc(new->nr_pages, sizeof(*new->zpages), GFP_KERNEL);
+  if (!new->pages || !new->zpages) {
+    kvfree(new->zpages);
+    kvfree(new->pages);
+    kfree(new);
+    return -ENOMEM;
+  }
+
+  mutex_lock(&dev_data->resize_gp_lock);
+  mutex_lock(&dev_data->resize_lock);
+
+  old = rcu_dereference_protected(dev_data->buf, lockdep_is_held(&dev_data->resize_lock));
+
+  // Only resident pages can be shared, bring back the reclaimed ones first
+  shared = min(old->nr_pages, new->nr_pages);
+  for (i = 0; i < shared; i++) {
+    page = pcd_reclaim_fault_locked(dev_data, old, i);
+    if (IS_ERR(page)) {
+      mutex_unlock(&dev_data->resize_lock);
+      mutex_unlock(&dev_data->resize_gp_lock);
+      pcd_buf_free(new);
+      return PTR_ERR(page);
+    }
+    get_page(page);
+    new->pages[i] = page;
+  }
+
+  for (i = shared; i < new->nr_pages; i++) {
+    new->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!new->pages[i]) {
+      mutex_unlock(&dev_data->resize_lock);
+      mutex_unlock(&dev_data->resize_gp_lock);
+      pcd_buf_free(new);
+      return -ENOMEM;
+    }
+  }
+
+  // A previous shrink may have left stale bytes past the old end of the last
+  // shared page. Its grace period is over and nobody can write there through
+  // the old buffer, so clear them before they become visible.
+  if (size > old->size && offset_in_page(old->size)) {
+    tail = min_t(size_t, size - old->size, PAGE_SIZE - offset_in_page(old->size));
+    memset(page_address(old->pages[old->size / PAGE_SIZE]) + offset_in_page(old->size), 0, tail);
+  }
+
+  rcu_assign_pointer(dev_data->buf, new);
+  WRITE_ONCE(dev_data->pdata.size, size);
+
+  mutex_unlock(&dev_data->resize_lock);
+
+  synchronize_srcu(&dev_data->srcu);
+  mutex_unlock(&dev_data->resize_gp_lock);
+
+  pcd_buf_free(old);
+
+  return 0;
+}
+
+// Returns the page at idx, faulting it back in if it was reclaimed. Callers are
+// counted in dev_data->users, so a page stays resident once it has been returned.
+struct page* pcd_buf_get_page(struct pcdev_private_data* dev_data, struct pcd_buf* buf, unsigned long idx)
+{
+  struct page* page = READ_ONCE(buf->pages[idx]);
+
+  if (likely(page)) {
+    return page;
+  }
+
+  mutex_lock(&dev_data->resize_lock);
+  page = pcd_reclaim_fault_locked(dev_data, buf, idx);
+  mutex_unlock(&dev_data->resize_lock);
+
+  return page;
+}
+
+int pcd_buf_fault_all(struct pcdev_private_data* dev_data, struct pcd_buf* buf)
+{
+  struct page* page;
+  unsigned long i;
+
+  for (i = 0; i < buf->nr_pages; i++) {
+    page = pcd_buf_get_page(dev_data, buf, i);
+    if (IS_ERR(page)) {
+      return PTR_ERR(page);
+    }
+  }
+
+  return 0;
+}
+
+int pcd_buf_copy_to_user(struct pcdev_private_data* dev_data, struct pcd_buf* buf, char __user* buff, size_t count, loff_t pos)
+{
+  struct page* page;
+  size_t offset;
+  size_t chunk;
+
+  while (count) {
+    offset = offset_in_page(pos);
+    chunk = min_t(size_t, count, PAGE_SIZE - offset);
+
+    page = pcd_buf_get_page(dev_data, buf, pos >> PAGE_SHIFT);
+    if (IS_ERR(page)) {
+      return PTR_ERR(page);
+    }
+
+    if (copy_to_user(buff, page_address(page) + offset, chunk)) {
+      return -EFAULT;
+    }
+
+    buff += chunk;
+    pos += chunk;
+    count -= chunk;
+  }
+
+  return 0;
+}
+
+int pcd_buf_copy_from_user(struct pcdev_private_data* dev_data, struct pcd_buf* buf, const char __user* buff, size_t count, loff_t pos)
+{
+  struct page* page;
+  size_t offset;
+  size_t chunk;
+
+  while (count) {
+    offset = offset_in_page(pos);
+    chunk = min_t(size_t, count, PAGE_SIZE - offset);
+
+    page = pcd_buf_get_page(dev_data, buf, pos >> PAGE_SHIFT);
+    if (IS_ERR(page)) {
+      return PTR_ERR(page);
+    }
+
+    if (copy_from_user(page_address(page) + offset, buff, chunk)) {
+      return -EFAULT;
+    }
+
+    buff += chunk;
+    pos += chunk;
+    count -= chunk;
+  }
+
+  return 0;
+}
+
+// Kernel buffer counterparts of the above, used by the sysfs contents attribute
+int pcd_buf_copy_out(struct pcdev_private_data* dev_data, struct pcd_buf* buf, void* dst, size_t count, loff_t pos)
+{
+  struct page* page;
+  size_t offset;
+  size_t chunk;
+
+  while (count) {
+    offset = offset_in_page(pos);
+    chunk = min_t(size_t, count, PAGE_SIZE - offset);
+
+    page = pcd_buf_get_page(dev_data, buf, pos >> PAGE_SHIFT);
+    if (IS_ERR(page)) {
+      return PTR_ERR(page);
+    }
+
+    memcpy(dst, page_address(page) + offset, chunk);
+
+    dst += chunk;
+    pos += chunk;
+    count -= chunk;
+  }
+
+  return 0;
+}
+
+int pcd_buf_copy_in(struct pcdev_private_data* dev_data, struct pcd_buf* buf, const void* src, size_t count, loff_t pos)
+{
+  struct page* page;
+  size_t offset;
+  size_t chunk;
+
+  while (count) {
+    offset = offset_in_page(pos);
+    chunk = min_t(size_t, count, PAGE_SIZE - offset);
+
+    page = pcd_buf_get_page(dev_data, buf, pos >> PAGE_SHIFT);
+    if (IS_ERR(page)) {
+      return PTR_ERR(page);
+    }
+
+    memcpy(page_address(page) + offset, src, chunk);
+
+    src += chunk;
+    pos += chunk;
+    count -= chunk;
+  }
+
+  return 0;
+}
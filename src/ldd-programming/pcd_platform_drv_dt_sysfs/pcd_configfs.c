@@ -0,0 +1,330 @@
+#include <linux/configfs.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+
+// Devices provisioned at runtime, without DT or a setup module:
+//
+//   mkdir /sys/kernel/config/pcd/foo
+//   echo 0x11 > /sys/kernel/config/pcd/foo/perm     # optional, defaults to RDWR
+//   echo FOO2023 > /sys/kernel/config/pcd/foo/serial # optional, defaults to the name
+//   echo 4096 > /sys/kernel/config/pcd/foo/size      # instantiates the device
+//   cat /sys/kernel/config/pcd/foo/dev               # pcdev-N
+//   rmdir /sys/kernel/config/pcd/foo
+//
+// Each item is backed by a "pcdev-A1x" platform device which this driver probes
+// right away. Once it exists, size and perm are applied to it live.
+
+#define PCD_CFS_SERIAL_LEN 32
+
+struct pcd_cfs_item {
+  struct config_item item;
+  struct mutex lock; // Protects everything below
+  u64 size;
+  int perm;
+  char serial[PCD_CFS_SERIAL_LEN];
+  struct platform_device* pdev;
+};
+
+static struct pcd_cfs_item* to_pcd_cfs_item(struct config_item* item)
+{
+  return container_of(item, struct pcd_cfs_item, item);
+}
+
+// Runs fn on the live device, if the driver is still bound to it. With item->lock held.
+static int pcd_cfs_apply(struct pcd_cfs_item* cfs, int (*fn)(struct pcdev_private_data* dev_data, u64 val), u64 val)
+{
+  struct pcdev_private_data* dev_data;
+  int ret = -ENODEV;
+
+  device_lock(&cfs->pdev->dev);
+  dev_data = dev_get_drvdata(&cfs->pdev->dev);
+  if (cfs->pdev->dev.driver && dev_data) {
+    ret = fn(dev_data, val);
+    if (!ret) {
+      pcd_netlink_notify(dev_data);
+    }
+  }
+  device_unlock(&cfs->pdev->dev);
+
+  return ret;
+}
+
+static int pcd_cfs_set_size(struct pcdev_private_data* dev_data, u64 size)
+{
+  return pcd_buf_resize(dev_data, size);
+}
+
+static int pcd_cfs_set_perm(struct pcdev_private_data* dev_data, u64 perm)
+{
+  // Only checked at open, existing fds keep their access
+  WRITE_ONCE(dev_data->pdata.perm, perm);
+
+  return 0;
+}
+
+// The platform core copies the platform data, the serial string stays ours and
+// outlives the device since the device goes away in drop_item
+static int pcd_cfs_instantiate(struct pcd_cfs_item* cfs)
+{
+  struct pcdev_platform_data pdata = {
+    .size = cfs->size,
+    .perm = cfs->perm,
+    .serial_num = cfs->serial,
+  };
+  struct platform_device_info info = {
+    .name = "pcdev-A1x",
+    .id = PLATFORM_DEVID_AUTO,
+    .data = &pdata,
+    .size_data = sizeof(pdata),
+  };
+  struct platform_device* pdev;
+
+  pdev = platform_device_register_full(&info);
+  if (IS_ERR(pdev)) {
+    return PTR_ERR(pdev);
+  }
+
+  // Probe is synchronous, an unbound device means it failed
+  if (!pdev->dev.driver) {
+    platform_device_unregister(pdev);
+    return -ENODEV;
+  }
+
+  cfs->pdev = pdev;
+
+  return 0;
+}
+
+static ssize_t pcd_cfs_size_show(struct config_item* item, char* page)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  ssize_t ret;
+
+  mutex_lock(&cfs->lock);
+  ret = sprintf(page, "%llu\n", cfs->size);
+  mutex_unlock(&cfs->lock);
+
+  return ret;
+}
+
+static ssize_t pcd_cfs_size_store(struct config_item* item, const char* page, size_t count)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  u64 size;
+  int ret;
+
+  ret = kstrtou64(page, 0, &size);
+  if (ret) {
+    return ret;
+  }
+
+  // Same limit as the max_size attribute
+  if (!size || size > INT_MAX) {
+    return -EINVAL;
+  }
+
+  mutex_lock(&cfs->lock);
+  if (cfs->pdev) {
+    ret = pcd_cfs_apply(cfs, pcd_cfs_set_size, size);
+    if (!ret) {
+      cfs->size = size;
+    }
+  } else {
+    cfs->size = size;
+    ret = pcd_cfs_instantiate(cfs);
+    if (ret) {
+      cfs->size = 0;
+    }
+  }
+  mutex_unlock(&cfs->lock);
+
+  return ret ? ret : count;
+}
+
+static ssize_t pcd_cfs_perm_show(struct config_item* item, char* page)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  ssize_t ret;
+
+  mutex_lock(&cfs->lock);
+  ret = sprintf(page, "0x%x\n", cfs->perm);
+  mutex_unlock(&cfs->lock);
+
+  return ret;
+}
+
+static ssize_t pcd_cfs_perm_store(struct config_item* item, const char* page, size_t count)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  u32 perm;
+  int ret;
+
+  ret = kstrtou32(page, 0, &perm);
+  if (ret) {
+    return ret;
+  }
+
+  if (perm != RDONLY && perm != WRONLY && perm != RDWR) {
+    return -EINVAL;
+  }
+
+  mutex_lock(&cfs->lock);
+  if (cfs->pdev) {
+    ret = pcd_cfs_apply(cfs, pcd_cfs_set_perm, perm);
+  }
+  if (!ret) {
+    cfs->perm = perm;
+  }
+  mutex_unlock(&cfs->lock);
+
+  return ret ? ret : count;
+}
+
+static ssize_t pcd_cfs_serial_show(struct config_item* item, char* page)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  ssize_t ret;
+
+  mutex_lock(&cfs->lock);
+  ret = sprintf(page, "%s\n", cfs->serial);
+  mutex_unlock(&cfs->lock);
+
+  return ret;
+}
+
+// The driver reads the serial number without locking, so it is fixed once the
+// device exists
+static ssize_t pcd_cfs_serial_store(struct config_item* item, const char* page, size_t count)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  size_t len = strcspn(page, "\n");
+  int ret = 0;
+
+  if (!len || len >= PCD_CFS_SERIAL_LEN) {
+    return -EINVAL;
+  }
+
+  mutex_lock(&cfs->lock);
+  if (cfs->pdev) {
+    ret = -EBUSY;
+  } else {
+    memcpy(cfs->serial, page, len);
+    cfs->serial[len] = '\0';
+  }
+  mutex_unlock(&cfs->lock);
+
+  return ret ? ret : count;
+}
+
+// Name of the character device, empty until size has been written
+static ssize_t pcd_cfs_dev_show(struct config_item* item, char* page)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+  struct pcdev_private_data* dev_data;
+  ssize_t ret = sprintf(page, "\n");
+
+  mutex_lock(&cfs->lock);
+  if (cfs->pdev) {
+    device_lock(&cfs->pdev->dev);
+    dev_data = dev_get_drvdata(&cfs->pdev->dev);
+    if (cfs->pdev->dev.driver && dev_data) {
+      ret = sprintf(page, "pcdev-%u\n", dev_data->id);
+    }
+    device_unlock(&cfs->pdev->dev);
+  }
+  mutex_unlock(&cfs->lock);
+
+  return ret;
+}
+
+CONFIGFS_ATTR(pcd_cfs_, size);
+CONFIGFS_ATTR(pcd_cfs_, perm);
+CONFIGFS_ATTR(pcd_cfs_, serial);
+CONFIGFS_ATTR_RO(pcd_cfs_, dev);
+
+static struct configfs_attribute* pcd_cfs_attrs[] = {
+  &pcd_cfs_attr_size,
+  &pcd_cfs_attr_perm,
+  &pcd_cfs_attr_serial,
+  &pcd_cfs_attr_dev,
+  NULL,
+};
+
+static void pcd_cfs_release(struct config_item* item)
+{
+  kfree(to_pcd_cfs_item(item));
+}
+
+static struct configfs_item_operations pcd_cfs_item_ops = {
+  .release = pcd_cfs_release,
+};
+
+static const struct config_item_type pcd_cfs_item_type = {
+  .ct_item_ops = &pcd_cfs_item_ops,
+  .ct_attrs = pcd_cfs_attrs,
+  .ct_owner = THIS_MODULE,
+};
+
+static struct config_item* pcd_cfs_make_item(struct config_group* group, const char* name)
+{
+  struct pcd_cfs_item* cfs;
+
+  cfs = kzalloc(sizeof(*cfs), GFP_KERNEL);
+  if (!cfs) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  mutex_init(&cfs->lock);
+  cfs->perm = RDWR;
+  strscpy(cfs->serial, name, sizeof(cfs->serial));
+
+  config_item_init_type_name(&cfs->item, name, &pcd_cfs_item_type);
+
+  return &cfs->item;
+}
+
+// rmdir takes the device down right away, the item itself goes with its last reference
+static void pcd_cfs_drop_item(struct config_group* group, struct config_item* item)
+{
+  struct pcd_cfs_item* cfs = to_pcd_cfs_item(item);
+
+  mutex_lock(&cfs->lock);
+  if (cfs->pdev) {
+    platform_device_unregister(cfs->pdev);
+    cfs->pdev = NULL;
+  }
+  mutex_unlock(&cfs->lock);
+
+  config_item_put(item);
+}
+
+static struct configfs_group_operations pcd_cfs_group_ops = {
+  .make_item = pcd_cfs_make_item,
+  .drop_item = pcd_cfs_drop_item,
+};
+
+static const struct config_item_type pcd_cfs_subsys_type = {
+  .ct_group_ops = &pcd_cfs_group_ops,
+  .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem pcd_cfs_subsys = {
+  .su_group = {
+    .cg_item = {
+      .ci_namebuf = "pcd",
+      .ci_type = &pcd_cfs_subsys_type,
+    },
+  },
+};
+
+int pcd_configfs_init(void)
+{
+  config_group_init(&pcd_cfs_subsys.su_group);
+  mutex_init(&pcd_cfs_subsys.su_mutex);
+
+  return configfs_register_subsystem(&pcd_cfs_subsys);
+}
+
+void pcd_configfs_exit(void)
+{
+  configfs_unregister_subsystem(&pcd_cfs_subsys);
+}
@@ -0,0 +1,269 @@
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/vmalloc.h>
+#include <linux/iosys-map.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+
+MODULE_IMPORT_NS(DMA_BUF);
+
+// Exported snapshot of a device buffer. It holds its own page references, so it
+// doesn't depend on the device staying around and the shrinker leaves the pages
+// alone for as long as it lives.
+struct pcd_dmabuf {
+  struct page** pages;
+  unsigned long nr_pages;
+  struct mutex lock; // Protects attachments
+  struct list_head attachments;
+};
+
+struct pcd_dmabuf_attachment {
+  struct device* dev;
+  struct sg_table sgt;
+  enum dma_data_direction dir; // DMA_NONE while not mapped
+  struct list_head node;
+};
+
+static int pcd_dmabuf_attach(struct dma_buf* dmabuf, struct dma_buf_attachment* attach)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+  struct pcd_dmabuf_attachment* a;
+  int ret;
+
+  a = kzalloc(sizeof(*a), GFP_KERNEL);
+  if (!a) {
+    return -ENOMEM;
+  }
+
+  ret = sg_alloc_table_from_pages(&a->sgt, pbuf->pages, pbuf->nr_pages, 0, pbuf->nr_pages << PAGE_SHIFT, GFP_KERNEL);
+  if (ret) {
+    kfree(a);
+    return ret;
+  }
+
+  a->dev = attach->dev;
+  a->dir = DMA_NONE;
+  attach->priv = a;
+
+  mutex_lock(&pbuf->lock);
+  list_add(&a->node, &pbuf->attachments);
+  mutex_unlock(&pbuf->lock);
+
+  return 0;
+}
+
+static void pcd_dmabuf_detach(struct dma_buf* dmabuf, struct dma_buf_attachment* attach)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+  struct pcd_dmabuf_attachment* a = attach->priv;
+
+  mutex_lock(&pbuf->lock);
+  list_del(&a->node);
+  mutex_unlock(&pbuf->lock);
+
+  sg_free_table(&a->sgt);
+  kfree(a);
+}
+
+static struct sg_table* pcd_dmabuf_map(struct dma_buf_attachment* attach, enum dma_data_direction dir)
+{
+  struct pcd_dmabuf* pbuf = attach->dmabuf->priv;
+  struct pcd_dmabuf_attachment* a = attach->priv;
+  int ret;
+
+  ret = dma_map_sgtable(attach->dev, &a->sgt, dir, 0);
+  if (ret) {
+    return ERR_PTR(ret);
+  }
+
+  mutex_lock(&pbuf->lock);
+  a->dir = dir;
+  mutex_unlock(&pbuf->lock);
+
+  return &a->sgt;
+}
+
+static void pcd_dmabuf_unmap(struct dma_buf_attachment* attach, struct sg_table* sgt, enum dma_data_direction dir)
+{
+  struct pcd_dmabuf* pbuf = attach->dmabuf->priv;
+  struct pcd_dmabuf_attachment* a = attach->priv;
+
+  mutex_lock(&pbuf->lock);
+  a->dir = DMA_NONE;
+  mutex_unlock(&pbuf->lock);
+
+  dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+}
+
+// CPU access goes through the pages directly, so all that is needed is to make
+// every device mapping coherent with the CPU around it
+static int pcd_dmabuf_begin_cpu_access(struct dma_buf* dmabuf, enum dma_data_direction dir)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+  struct pcd_dmabuf_attachment* a;
+
+  mutex_lock(&pbuf->lock);
+  list_for_each_entry(a, &pbuf->attachments, node) {
+    if (a->dir != DMA_NONE) {
+      dma_sync_sgtable_for_cpu(a->dev, &a->sgt, a->dir);
+    }
+  }
+  mutex_unlock(&pbuf->lock);
+
+  return 0;
+}
+
+static int pcd_dmabuf_end_cpu_access(struct dma_buf* dmabuf, enum dma_data_direction dir)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+  struct pcd_dmabuf_attachment* a;
+
+  mutex_lock(&pbuf->lock);
+  list_for_each_entry(a, &pbuf->attachments, node) {
+    if (a->dir != DMA_NONE) {
+      dma_sync_sgtable_for_device(a->dev, &a->sgt, a->dir);
+    }
+  }
+  mutex_unlock(&pbuf->lock);
+
+  return 0;
+}
+
+static int pcd_dmabuf_mmap(struct dma_buf* dmabuf, struct vm_area_struct* vma)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+
+  return vm_map_pages(vma, pbuf->pages, pbuf->nr_pages);
+}
+
+static int pcd_dmabuf_vmap(struct dma_buf* dmabuf, struct iosys_map* map)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+  void* vaddr;
+
+  vaddr = vm_map_ram(pbuf->pages, pbuf->nr_pages, NUMA_NO_NODE);
+  if (!vaddr) {
+    return -ENOMEM;
+  }
+
+  iosys_map_set_vaddr(map, vaddr);
+
+  return 0;
+}
+
+static void pcd_dmabuf_vunmap(struct dma_buf* dmabuf, struct iosys_map* map)
+{
+  struct pcd_dmabuf* pbuf = dmabuf->priv;
+
+  vm_unmap_ram(map->vaddr, pbuf->nr_pages);
+}
+
+static void pcd_dmabuf_free(struct pcd_dmabuf* pbuf)
+{
+  unsigned long i;
+
+  for (i = 0; i < pbuf->nr_pages; i++) {
+    put_page(pbuf->pages[i]);
+  }
+
+  kvfree(pbuf->pages);
+  kfree(pbuf);
+}
+
+static void pcd_dmabuf_release(struct dma_buf* dmabuf)
+{
+  pcd_dmabuf_free(dmabuf->priv);
+}
+
+static const struct dma_buf_ops pcd_dmabuf_ops = {
+  .attach = pcd_dmabuf_attach,
+  .detach = pcd_dmabuf_detach,
+  .map_dma_buf = pcd_dmabuf_map,
+  .unmap_dma_buf = pcd_dmabuf_unmap,
+  .begin_cpu_access = pcd_dmabuf_begin_cpu_access,
+  .end_cpu_access = pcd_dmabuf_end_cpu_access,
+  .mmap = pcd_dmabuf_mmap,
+  .vmap = pcd_dmabuf_vmap,
+  .vunmap = pcd_dmabuf_vunmap,
+  .release = pcd_dmabuf_release,
+};
+
+// Takes a reference on every page of the current buffer, faulting reclaimed
+// ones back in first
+static int pcd_dmabuf_grab_pages(struct pcdev_private_data* dev_data, struct pcd_dmabuf* pbuf)
+{
+  struct pcd_buf* buf;
+  unsigned long i;
+  int ret;
+  int idx;
+
+  pcd_reclaim_get(dev_data);
+  idx = srcu_read_lock(&dev_data->srcu);
+  buf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+
+  ret = pcd_buf_fault_all(dev_data, buf);
+  if (ret) {
+    goto unlock;
+  }
+
+  pbuf->pages = kvcalloc(buf->nr_pages, sizeof(*pbuf->pages), GFP_KERNEL);
+  if (!pbuf->pages) {
+    ret = -ENOMEM;
+    goto unlock;
+  }
+
+  // Users can't drop to zero while we hold one, so nothing is reclaimed in between
+  for (i = 0; i < buf->nr_pages; i++) {
+    pbuf->pages[i] = buf->pages[i];
+    get_page(pbuf->pages[i]);
+  }
+  pbuf->nr_pages = buf->nr_pages;
+
+unlock:
+  srcu_read_unlock(&dev_data->srcu, idx);
+  pcd_reclaim_put(dev_data);
+
+  return ret;
+}
+
+// Returns the new dma-buf fd
+int pcd_dmabuf_export(struct pcdev_private_data* dev_data, bool writable, bool cloexec)
+{
+  DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+  struct pcd_dmabuf* pbuf;
+  struct dma_buf* dmabuf;
+  int flags = (writable ? O_RDWR : O_RDONLY) | (cloexec ? O_CLOEXEC : 0);
+  int ret;
+
+  pbuf = kzalloc(sizeof(*pbuf), GFP_KERNEL);
+  if (!pbuf) {
+    return -ENOMEM;
+  }
+
+  mutex_init(&pbuf->lock);
+  INIT_LIST_HEAD(&pbuf->attachments);
+
+  ret = pcd_dmabuf_grab_pages(dev_data, pbuf);
+  if (ret) {
+    kfree(pbuf);
+    return ret;
+  }
+
+  exp_info.ops = &pcd_dmabuf_ops;
+  exp_info.size = pbuf->nr_pages << PAGE_SHIFT;
+  exp_info.flags = flags;
+  exp_info.priv = pbuf;
+
+  dmabuf = dma_buf_export(&exp_info);
+  if (IS_ERR(dmabuf)) {
+    pcd_dmabuf_free(pbuf);
+    return PTR_ERR(dmabuf);
+  }
+
+  ret = dma_buf_fd(dmabuf, flags);
+  if (ret < 0) {
+    dma_buf_put(dmabuf);
+  }
+
+  return ret;
+}
@@ -0,0 +1,175 @@
+/*
+ * Round trip through a dma-buf exported from a pcd device, in the spirit of the
+ * udmabuf selftest: data written through the device shows up in the dma-buf
+ * mapping, data written through the mapping shows up in device reads, and a
+ * read-only device fd only hands out a read-only dma-buf.
+ *
+ *   gcc -O2 -o pcd_dmabuf_test pcd_dmabuf_test.c
+ *   ./pcd_dmabuf_test /dev/pcdev-0 [/dev/pcdev-2]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include "pcd_ioctl.h"
+
+static int export_dmabuf(int fd)
+{
+  struct pcd_dmabuf_export exp = { .flags = PCD_DMABUF_CLOEXEC };
+
+  if (ioctl(fd, PCD_IOC_EXPORT_DMABUF, &exp) < 0) {
+    perror("PCD_IOC_EXPORT_DMABUF");
+    return -1;
+  }
+
+  return exp.fd;
+}
+
+static int dmabuf_sync(int dmabuf_fd, unsigned long long flags)
+{
+  struct dma_buf_sync sync = { .flags = flags };
+
+  if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+    perror("DMA_BUF_IOCTL_SYNC");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int test_round_trip(const char* path)
+{
+  char *wbuf, *rbuf, *map;
+  off_t size, map_size;
+  int fd, dmabuf_fd;
+  int ret = -1;
+
+  fd = open(path, O_RDWR);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  size = lseek(fd, 0, SEEK_END);
+  wbuf = malloc(size);
+  rbuf = malloc(size);
+  if (size <= 0 || !wbuf || !rbuf) {
+    fprintf(stderr, "%s: bad device size\n", path);
+    goto close_fd;
+  }
+
+  memset(wbuf, 0x5a, size);
+  if (pwrite(fd, wbuf, size, 0) != size) {
+    perror("pwrite");
+    goto close_fd;
+  }
+
+  dmabuf_fd = export_dmabuf(fd);
+  if (dmabuf_fd < 0) {
+    goto close_fd;
+  }
+
+  map_size = lseek(dmabuf_fd, 0, SEEK_END);
+  map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap dma-buf");
+    goto close_dmabuf;
+  }
+
+  // Device writes are visible through the dma-buf
+  if (dmabuf_sync(dmabuf_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ)) {
+    goto unmap;
+  }
+  if (memcmp(map, wbuf, size)) {
+    fprintf(stderr, "dma-buf doesn't see data written to the device\n");
+    goto unmap;
+  }
+  dmabuf_sync(dmabuf_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+  // And dma-buf writes are visible through the device
+  if (dmabuf_sync(dmabuf_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE)) {
+    goto unmap;
+  }
+  memset(map, 0xa5, size);
+  dmabuf_sync(dmabuf_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+  memset(wbuf, 0xa5, size);
+  if (pread(fd, rbuf, size, 0) != size || memcmp(rbuf, wbuf, size)) {
+    fprintf(stderr, "device doesn't see data written to the dma-buf\n");
+    goto unmap;
+  }
+
+  printf("%s: round trip through %lld byte dma-buf ok\n", path, (long long)map_size);
+  ret = 0;
+
+unmap:
+  munmap(map, map_size);
+close_dmabuf:
+  close(dmabuf_fd);
+close_fd:
+  free(rbuf);
+  free(wbuf);
+  close(fd);
+
+  return ret;
+}
+
+// Needs a RDONLY device, the driver refuses read-only opens of RDWR ones
+static int test_read_only(const char* path)
+{
+  void* map;
+  int fd, dmabuf_fd;
+  int ret = -1;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  dmabuf_fd = export_dmabuf(fd);
+  if (dmabuf_fd < 0) {
+    goto close_fd;
+  }
+
+  map = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+  if (map != MAP_FAILED) {
+    fprintf(stderr, "%s: read-only fd exported a writable dma-buf\n", path);
+    munmap(map, getpagesize());
+    goto close_dmabuf;
+  }
+
+  printf("%s: read-only export ok\n", path);
+  ret = 0;
+
+close_dmabuf:
+  close(dmabuf_fd);
+close_fd:
+  close(fd);
+
+  return ret;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <RDWR pcd dev> [RDONLY pcd dev]\n", argv[0]);
+    return 1;
+  }
+
+  if (test_round_trip(argv[1])) {
+    return 1;
+  }
+
+  if (argc > 2 && test_read_only(argv[2])) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef PCD_IOCTL_H
+#define PCD_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define PCD_IOC_MAGIC 'p'
+
+#define PCD_DMABUF_CLOEXEC 0x01
+
+struct pcd_dmabuf_export {
+  __u32 flags; // PCD_DMABUF_*
+  __s32 fd;    // Returned dma-buf fd
+};
+
+// Exports the device buffer as a dma-buf without copying it. The dma-buf covers the
+// buffer as it is at export time (rounded up to whole pages) and keeps those pages
+// alive and resident; a later max_size change doesn't affect it. It is writable only
+// if the device fd was opened for writing. Bracket CPU access to an mmap of it with
+// DMA_BUF_IOCTL_SYNC.
+#define PCD_IOC_EXPORT_DMABUF _IOWR(PCD_IOC_MAGIC, 0x10, struct pcd_dmabuf_export)
+
+#endif // PCD_IOCTL_H
@@ -0,0 +1,246 @@
+#include <net/genetlink.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_netlink.h"
+
+#define PCD_NL_MCGRP_EVENTS 0
+
+static const struct nla_policy pcd_nl_policy[PCD_ATTR_MAX + 1] = {
+  [PCD_ATTR_DEVICE] = { .type = NLA_NESTED },
+  [PCD_ATTR_DEV_ID] = { .type = NLA_U32 },
+  [PCD_ATTR_SIZE] = NLA_POLICY_RANGE(NLA_U64, 1, INT_MAX),
+  [PCD_ATTR_PERM] = { .type = NLA_U32 },
+};
+
+static int pcd_nl_get_doit(struct sk_buff* skb, struct genl_info* info);
+static int pcd_nl_get_dumpit(struct sk_buff* skb, struct netlink_callback* cb);
+static int pcd_nl_set_doit(struct sk_buff* skb, struct genl_info* info);
+
+static const struct genl_ops pcd_nl_ops[] = {
+  {
+    .cmd = PCD_CMD_GET,
+    .doit = pcd_nl_get_doit,
+    .dumpit = pcd_nl_get_dumpit,
+  },
+  {
+    .cmd = PCD_CMD_SET,
+    .doit = pcd_nl_set_doit,
+    .flags = GENL_ADMIN_PERM,
+  },
+};
+
+static const struct genl_multicast_group pcd_nl_mcgrps[] = {
+  [PCD_NL_MCGRP_EVENTS] = { .name = PCD_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family pcd_nl_family = {
+  .name = PCD_GENL_NAME,
+  .version = PCD_GENL_VERSION,
+  .maxattr = PCD_ATTR_MAX,
+  .policy = pcd_nl_policy,
+  .ops = pcd_nl_ops,
+  .n_ops = ARRAY_SIZE(pcd_nl_ops),
+  .resv_start_op = __PCD_CMD_MAX,
+  .mcgrps = pcd_nl_mcgrps,
+  .n_mcgrps = ARRAY_SIZE(pcd_nl_mcgrps),
+  .module = THIS_MODULE,
+};
+
+static int pcd_nl_fill(struct sk_buff* skb, struct pcdev_private_data* dev_data, u32 portid, u32 seq, int flags, u8 cmd)
+{
+  void* hdr;
+
+  hdr = genlmsg_put(skb, portid, seq, &pcd_nl_family, flags, cmd);
+  if (!hdr) {
+    return -EMSGSIZE;
+  }
+
+  if (nla_put_u32(skb, PCD_ATTR_DEV_ID, dev_data->id) ||
+      nla_put_string(skb, PCD_ATTR_SERIAL, dev_data->pdata.serial_num) ||
+      nla_put_u64_64bit(skb, PCD_ATTR_SIZE, READ_ONCE(dev_data->pdata.size), PCD_ATTR_PAD) ||
+      nla_put_u32(skb, PCD_ATTR_PERM, READ_ONCE(dev_data->pdata.perm)) ||
+      nla_put_u32(skb, PCD_ATTR_USERS, READ_ONCE(dev_data->users)) ||
+      nla_put_u64_64bit(skb, PCD_ATTR_RECLAIMED, atomic_long_read(&dev_data->reclaimed), PCD_ATTR_PAD) ||
+      nla_put_u64_64bit(skb, PCD_ATTR_REFAULTED, atomic_long_read(&dev_data->refaulted), PCD_ATTR_PAD)) {
+    genlmsg_cancel(skb, hdr);
+    return -EMSGSIZE;
+  }
+
+  genlmsg_end(skb, hdr);
+
+  return 0;
+}
+
+static int pcd_nl_get_doit(struct sk_buff* skb, struct genl_info* info)
+{
+  struct pcdev_private_data* dev_data;
+  struct sk_buff* msg;
+  int ret;
+
+  if (GENL_REQ_ATTR_CHECK(info, PCD_ATTR_DEV_ID)) {
+    return -EINVAL;
+  }
+
+  msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+  if (!msg) {
+    return -ENOMEM;
+  }
+
+  mutex_lock(&pcdrv_data.devices_lock);
+  dev_data = xa_load(&pcdrv_data.devices, nla_get_u32(info->attrs[PCD_ATTR_DEV_ID]));
+  if (dev_data) {
+    ret = pcd_nl_fill(msg, dev_data, info->snd_portid, info->snd_seq, 0, PCD_CMD_GET);
+  } else {
+    NL_SET_BAD_ATTR(info->extack, info->attrs[PCD_ATTR_DEV_ID]);
+    ret = -ENODEV;
+  }
+  mutex_unlock(&pcdrv_data.devices_lock);
+
+  if (ret) {
+    nlmsg_free(msg);
+    return ret;
+  }
+
+  return genlmsg_reply(msg, info);
+}
+
+// Resumes from the device id after the last one that fit in cb->args[0]
+static int pcd_nl_get_dumpit(struct sk_buff* skb, struct netlink_callback* cb)
+{
+  struct pcdev_private_data* dev_data;
+  unsigned long id;
+  int ret = 0;
+
+  mutex_lock(&pcdrv_data.devices_lock);
+  xa_for_each_start(&pcdrv_data.devices, id, dev_data, cb->args[0]) {
+    ret = pcd_nl_fill(skb, dev_data, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq, NLM_F_MULTI, PCD_CMD_GET);
+    if (ret) {
+      break;
+    }
+    cb->args[0] = id + 1;
+  }
+  mutex_unlock(&pcdrv_data.devices_lock);
+
+  // A full skb just means the rest goes in the next part
+  if (ret == -EMSGSIZE && skb->len) {
+    return skb->len;
+  }
+
+  return ret ? ret : skb->len;
+}
+
+static bool pcd_nl_perm_valid(u32 perm)
+{
+  return perm == RDONLY || perm == WRONLY || perm == RDWR;
+}
+
+// Looks up and validates one PCD_ATTR_DEVICE nest, with devices_lock held
+static struct pcdev_private_data* pcd_nl_parse_device(const struct nlattr* nla, struct nlattr** tb, struct netlink_ext_ack* extack)
+{
+  struct pcdev_private_data* dev_data;
+  int ret;
+
+  ret = nla_parse_nested(tb, PCD_ATTR_MAX, nla, pcd_nl_policy, extack);
+  if (ret) {
+    return ERR_PTR(ret);
+  }
+
+  if (NL_REQ_ATTR_CHECK(extack, nla, tb, PCD_ATTR_DEV_ID)) {
+    return ERR_PTR(-EINVAL);
+  }
+
+  dev_data = xa_load(&pcdrv_data.devices, nla_get_u32(tb[PCD_ATTR_DEV_ID]));
+  if (!dev_data) {
+    NL_SET_ERR_MSG_ATTR(extack, tb[PCD_ATTR_DEV_ID], "No such device");
+    return ERR_PTR(-ENODEV);
+  }
+
+  if (tb[PCD_ATTR_PERM] && !pcd_nl_perm_valid(nla_get_u32(tb[PCD_ATTR_PERM]))) {
+    NL_SET_ERR_MSG_ATTR(extack, tb[PCD_ATTR_PERM], "Permission must be RDONLY, WRONLY or RDWR");
+    return ERR_PTR(-EINVAL);
+  }
+
+  return dev_data;
+}
+
+static int pcd_nl_set_doit(struct sk_buff* skb, struct genl_info* info)
+{
+  struct nlattr* tb[PCD_ATTR_MAX + 1];
+  struct pcdev_private_data* dev_data;
+  const struct nlattr* nla;
+  int ret = 0;
+  int rem;
+
+  mutex_lock(&pcdrv_data.devices_lock);
+
+  // First pass only validates, so a bad entry anywhere leaves every device as it was
+  nlmsg_for_each_attr(nla, info->nlhdr, GENL_HDRLEN, rem) {
+    if (nla_type(nla) != PCD_ATTR_DEVICE) {
+      continue;
+    }
+    dev_data = pcd_nl_parse_device(nla, tb, info->extack);
+    if (IS_ERR(dev_data)) {
+      ret = PTR_ERR(dev_data);
+      goto unlock;
+    }
+  }
+
+  nlmsg_for_each_attr(nla, info->nlhdr, GENL_HDRLEN, rem) {
+    if (nla_type(nla) != PCD_ATTR_DEVICE) {
+      continue;
+    }
+    dev_data = pcd_nl_parse_device(nla, tb, info->extack);
+
+    if (tb[PCD_ATTR_SIZE]) {
+      // Can still run out of memory, devices before this one keep their new size
+      ret = pcd_buf_resize(dev_data, nla_get_u64(tb[PCD_ATTR_SIZE]));
+      if (ret) {
+        NL_SET_ERR_MSG_ATTR(info->extack, tb[PCD_ATTR_SIZE], "Resize failed");
+        goto unlock;
+      }
+    }
+
+    // Only checked at open, existing fds keep their access
+    if (tb[PCD_ATTR_PERM]) {
+      WRITE_ONCE(dev_data->pdata.perm, nla_get_u32(tb[PCD_ATTR_PERM]));
+    }
+
+    pcd_netlink_notify(dev_data);
+  }
+
+unlock:
+  mutex_unlock(&pcdrv_data.devices_lock);
+
+  return ret;
+}
+
+// Multicasts the current state of a device after its configuration changed
+void pcd_netlink_notify(struct pcdev_private_data* dev_data)
+{
+  struct sk_buff* msg;
+
+  if (!genl_has_listeners(&pcd_nl_family, &init_net, PCD_NL_MCGRP_EVENTS)) {
+    return;
+  }
+
+  msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+  if (!msg) {
+    return;
+  }
+
+  if (pcd_nl_fill(msg, dev_data, 0, 0, 0, PCD_CMD_CHANGED)) {
+    nlmsg_free(msg);
+    return;
+  }
+
+  genlmsg_multicast(&pcd_nl_family, msg, 0, PCD_NL_MCGRP_EVENTS, GFP_KERNEL);
+}
+
+int pcd_netlink_init(void)
+{
+  return genl_register_family(&pcd_nl_family);
+}
+
+void pcd_netlink_exit(void)
+{
+  genl_unregister_family(&pcd_nl_family);
+}
@@ -0,0 +1,41 @@
+#ifndef PCD_NETLINK_H
+#define PCD_NETLINK_H
+
+// Generic netlink interface of the pcd sysfs driver, shared with user space.
+//
+// PCD_CMD_GET with NLM_F_DUMP returns one message per device, so a whole fleet
+// is scraped in a single multipart reply; with PCD_ATTR_DEV_ID it returns just
+// that device. PCD_CMD_SET (CAP_NET_ADMIN) takes any number of PCD_ATTR_DEVICE
+// nests, each holding PCD_ATTR_DEV_ID plus PCD_ATTR_SIZE and/or PCD_ATTR_PERM.
+// All of them are validated before any is applied. Every configuration change,
+// through netlink or sysfs, is multicast to the "events" group as PCD_CMD_CHANGED.
+
+#define PCD_GENL_NAME "pcd"
+#define PCD_GENL_VERSION 1
+#define PCD_GENL_MCGRP_EVENTS "events"
+
+enum pcd_cmd {
+  PCD_CMD_UNSPEC,
+  PCD_CMD_GET,
+  PCD_CMD_SET,
+  PCD_CMD_CHANGED,
+  __PCD_CMD_MAX,
+};
+#define PCD_CMD_MAX (__PCD_CMD_MAX - 1)
+
+enum pcd_attr {
+  PCD_ATTR_UNSPEC,
+  PCD_ATTR_PAD,
+  PCD_ATTR_DEVICE,    // nested, PCD_CMD_SET only
+  PCD_ATTR_DEV_ID,    // u32, N of /dev/pcdev-N
+  PCD_ATTR_SERIAL,    // string
+  PCD_ATTR_SIZE,      // u64, max_size in bytes
+  PCD_ATTR_PERM,      // u32, RDONLY (0x01), WRONLY (0x10) or RDWR (0x11)
+  PCD_ATTR_USERS,     // u32, open files and sysfs accesses
+  PCD_ATTR_RECLAIMED, // u64, pages reclaimed so far
+  PCD_ATTR_REFAULTED, // u64, reclaimed pages brought back so far
+  __PCD_ATTR_MAX,
+};
+#define PCD_ATTR_MAX (__PCD_ATTR_MAX - 1)
+
+#endif // PCD_NETLINK_H
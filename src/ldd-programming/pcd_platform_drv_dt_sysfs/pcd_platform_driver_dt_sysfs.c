@@ -1,12 +1,30 @@
 #include "pcd_platform_driver_dt_sysfs.h"
 
-#define MAX_DEVICES 10
+// Enough for devices provisioned in bulk through configfs
+#define MAX_DEVICES 4096
+
+// How long a device stays up after its last fd is closed, also tunable per device
+// through power/autosuspend_delay_ms. Its pages can only be reclaimed once it has
+// suspended.
+static int autosuspend_delay_ms = 5000;
+module_param(autosuspend_delay_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_delay_ms, "Default idle time in ms before a device is runtime suspended and reclaimable");
+
+static int pcd_runtime_suspend(struct device* dev);
+static int pcd_runtime_resume(struct device* dev);
+
+static const struct dev_pm_ops pcd_pm_ops = {
+  SET_RUNTIME_PM_OPS(pcd_runtime_suspend, pcd_runtime_resume, NULL)
+};
 
 static const struct file_operations pcd_fops = {
   .open = pcd_open,
   .release = pcd_release,
   .read = pcd_read,
   .write = pcd_write,
+  .llseek = pcd_lseek,
+  .unlocked_ioctl = pcd_ioctl,
+  .compat_ioctl = compat_ptr_ioctl,
   .owner = THIS_MODULE,
 };
 
@@ -50,15 +68,40 @@ static const struct platform_driver pcd_platform_driver = {
   .driver = {
     .name = "pseudo-char-device",
     .of_match_table = of_match_ptr(org_pcdev_dt_match),
+    .pm = &pcd_pm_ops,
   },
 };
 
-struct pcdrv_private_data pcdrv_data;
+struct pcdrv_private_data pcdrv_data = {
+  .devices = XARRAY_INIT(pcdrv_data.devices, XA_FLAGS_ALLOC),
+  .devices_lock = __MUTEX_INITIALIZER(pcdrv_data.devices_lock),
+};
+
+static void pcdev_free(struct kref* ref)
+{
+  struct pcdev_private_data* dev_data = container_of(ref, struct pcdev_private_data, ref);
+
+  cleanup_srcu_struct(&dev_data->srcu);
+  pcd_buf_free(rcu_access_pointer(dev_data->buf));
+  put_device(dev_data->dev);
+  kfree(dev_data);
+}
+
+void pcdev_put(struct pcdev_private_data* dev_data)
+{
+  kref_put(&dev_data->ref, pcdev_free);
+}
+
+// Drops the reference of the bound device, once devres runs after remove
+static void pcdev_put_action(void* data)
+{
+  pcdev_put(data);
+}
 
 ssize_t show_max_size(struct device* dev, struct device_attribute* attr, char* buf)
 {
   struct pcdev_private_data* dev_data = dev_get_drvdata(dev->parent);
-  return sprintf(buf, "%d\n", dev_data->pdata.size);
+  return sprintf(buf, "%d\n", READ_ONCE(dev_data->pdata.size));
 }
 
 ssize_t store_max_size(struct device* dev, struct device_attribute* attr, const char* buf, size_t count)
@@ -72,8 +115,17 @@ ssize_t store_max_size(struct device* dev, struct device_attribute* attr, const
     return ret;
   }
 
-  dev_data->pdata.size = result;
-  dev_data->buffer = krealloc(dev_data->buf, dev_data->pdata.size, GFP_KERNEL);
+  if (result <= 0 || result > INT_MAX) {
+    return -EINVAL;
+  }
+
+  // Online resize, in-flight reads and writes are not blocked
+  ret = pcd_buf_resize(dev_data, result);
+  if (ret) {
+    return ret;
+  }
+
+  pcd_netlink_notify(dev_data);
 
   return count;
 }
@@ -84,17 +136,164 @@ ssize_t show_serial_num(struct device* dev, struct device_attribute* attr, char*
   return sprintf(buf, "%s\n", dev_data->pdata.serial_num);
 }
 
+// Pages handed back to the system by the shrinker and pages brought back on access
+ssize_t show_reclaimed(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(dev->parent);
+  return sprintf(buf, "%ld\n", atomic_long_read(&dev_data->reclaimed));
+}
+
+ssize_t show_refaulted(struct device* dev, struct device_attribute* attr, char* buf)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(dev->parent);
+  return sprintf(buf, "%ld\n", atomic_long_read(&dev_data->refaulted));
+}
+
+// A contents access uses the device like an open file does: it resumes it and
+// keeps the shrinker away until it is done
+static int pcd_contents_begin(struct pcdev_private_data* dev_data)
+{
+  int ret;
+
+  ret = pm_runtime_resume_and_get(dev_data->dev);
+  if (ret < 0) {
+    return ret;
+  }
+
+  pcd_reclaim_get(dev_data);
+
+  return 0;
+}
+
+static void pcd_contents_end(struct pcdev_private_data* dev_data)
+{
+  pcd_reclaim_put(dev_data);
+
+  pm_runtime_mark_last_busy(dev_data->dev);
+  pm_runtime_put_autosuspend(dev_data->dev);
+}
+
+// The contents attribute serves the device buffer straight out of its pages,
+// independent of the device's perm policy (root only through the file mode).
+ssize_t read_contents(struct file* filp, struct kobject* kobj, struct bin_attribute* attr, char* buf, loff_t off, size_t count)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(kobj_to_dev(kobj)->parent);
+  struct pcd_buf* pbuf;
+  int ret;
+  int idx;
+
+  ret = pcd_contents_begin(dev_data);
+  if (ret) {
+    return ret;
+  }
+
+  idx = srcu_read_lock(&dev_data->srcu);
+  pbuf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+
+  if (off >= pbuf->size) {
+    count = 0;
+  } else if ((off + count) > pbuf->size) {
+    count = pbuf->size - off;
+  }
+  ret = pcd_buf_copy_out(dev_data, pbuf, buf, count, off);
+
+  srcu_read_unlock(&dev_data->srcu, idx);
+  pcd_contents_end(dev_data);
+
+  return ret ? ret : count;
+}
+
+ssize_t write_contents(struct file* filp, struct kobject* kobj, struct bin_attribute* attr, char* buf, loff_t off, size_t count)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(kobj_to_dev(kobj)->parent);
+  struct pcd_buf* pbuf;
+  int ret;
+  int idx;
+
+  ret = pcd_contents_begin(dev_data);
+  if (ret) {
+    return ret;
+  }
+
+  idx = srcu_read_lock(&dev_data->srcu);
+  pbuf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+
+  if ((off + count) > pbuf->size) {
+    count = (off < pbuf->size) ? pbuf->size - off : 0;
+  }
+  if (count) {
+    ret = pcd_buf_copy_in(dev_data, pbuf, buf, count, off);
+  } else {
+    ret = -ENOMEM;
+  }
+
+  srcu_read_unlock(&dev_data->srcu, idx);
+  pcd_contents_end(dev_data);
+
+  return ret ? ret : count;
+}
+
+// Maps the buffer pages themselves. The mapping holds its own page references,
+// so it stays valid across max_size changes (it keeps the pages it started with).
+// Mapped pages are never reclaimed, so everything is brought back in up front.
+int mmap_contents(struct file* filp, struct kobject* kobj, struct bin_attribute* attr, struct vm_area_struct* vma)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(kobj_to_dev(kobj)->parent);
+  struct pcd_buf* pbuf;
+  int ret;
+  int idx;
+
+  ret = pcd_contents_begin(dev_data);
+  if (ret) {
+    return ret;
+  }
+
+  idx = srcu_read_lock(&dev_data->srcu);
+  pbuf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+  ret = pcd_buf_fault_all(dev_data, pbuf);
+  if (!ret) {
+    ret = vm_map_pages(vma, pbuf->pages, pbuf->nr_pages);
+  }
+  srcu_read_unlock(&dev_data->srcu, idx);
+  pcd_contents_end(dev_data);
+
+  return ret;
+}
+
 static DEVICE_ATTR(max_size, S_IRUGO|S_IWUSR, show_max_size, store_max_size);
 static DEVICE_ATTR(serial_num, S_IRUGO, show_serial_num, NULL);
+static DEVICE_ATTR(reclaimed, S_IRUGO, show_reclaimed, NULL);
+static DEVICE_ATTR(refaulted, S_IRUGO, show_refaulted, NULL);
+
+static struct bin_attribute bin_attr_contents = {
+  .attr = { .name = "contents", .mode = S_IRUSR|S_IWUSR },
+  .read = read_contents,
+  .write = write_contents,
+  .mmap = mmap_contents,
+};
 
 struct attribute* pcd_attrs[] = {
   &dev_attr_max_size.attr,
-  &dev_attr_serial_number.attr,
+  &dev_attr_serial_num.attr,
+  &dev_attr_reclaimed.attr,
+  &dev_attr_refaulted.attr,
+  NULL,
+};
+
+struct bin_attribute* pcd_bin_attrs[] = {
+  &bin_attr_contents,
   NULL,
 };
 
 struct attribute_group pcd_attr_group = {
   .attrs = pcd_attrs,
+  .bin_attrs = pcd_bin_attrs,
+};
+
+// Created along with the device, before its uevent goes out
+const struct attribute_group* pcd_attr_groups[] = {
+  &pcd_attr_group,
+  NULL,
 };
 
 static int __init pcd_platform_driver_init(void)
@@ -111,19 +310,57 @@ static int __init pcd_platform_driver_init(void)
   if (IS_ERR(pcdrv_data.pcd_class)) {
     pr_err("Class creation failed\n");
     ret = PTR_ERR(pcdrv_data.pcd_class);
-    return ret;
+    goto unreg_chrdev;
+  }
+
+  ret = pcd_reclaim_init();
+  if (ret) {
+    pr_err("Shrinker registration failed\n");
+    goto destroy_class;
+  }
+
+  // Registered before the driver, whose attributes notify the family once bound
+  ret = pcd_netlink_init();
+  if (ret) {
+    pr_err("Generic netlink family registration failed\n");
+    goto reclaim_exit;
   }
 
-  platform_driver_register(&pcd_platform_driver);
+  ret = platform_driver_register(&pcd_platform_driver);
+  if (ret) {
+    pr_err("Platform driver registration failed\n");
+    goto unreg_netlink;
+  }
+
+  ret = pcd_configfs_init();
+  if (ret) {
+    pr_err("Configfs subsystem registration failed\n");
+    goto unreg_driver;
+  }
 
   pr_info("Pcd platform driver loaded\n");
 
   return 0;
+
+unreg_driver:
+  platform_driver_unregister(&pcd_platform_driver);
+unreg_netlink:
+  pcd_netlink_exit();
+reclaim_exit:
+  pcd_reclaim_exit();
+destroy_class:
+  class_destroy(pcdrv_data.pcd_class);
+unreg_chrdev:
+  unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
+  return ret;
 }
 
 static void __exit pcd_platform_driver_exit(void)
 {
+  pcd_configfs_exit();
   platform_driver_unregister(&pcd_platform_driver);
+  pcd_netlink_exit();
+  pcd_reclaim_exit();
   class_destroy(pcdrv_data.pcd_class);
   unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
 
@@ -164,17 +401,36 @@ static pcdev_platform_data* pcdev_get_platdata_from_dt(struct device* dev)
   return pdata;
 }
 
-static int pcd_sysfs_create_files(struct device* pcd_dev)
+// Hands the buffer over to the shrinker. It is the device's only resource, and
+// compressing it right away would cost a refault on the next access even when
+// memory isn't short, so it is only given back under pressure.
+static int pcd_runtime_suspend(struct device* dev)
 {
-  int ret;
-  
-  return sysfs_create_group(&pcd_dev->kobj, &pcd_attr_group);
+  struct pcdev_private_data* dev_data = dev_get_drvdata(dev);
+
+  pcd_reclaim_suspend(dev_data);
+  dev_dbg(dev, "Runtime suspend\n");
+
+  return 0;
+}
+
+// Takes the buffer back from the shrinker. Nothing to restore eagerly, reclaimed
+// pages fault back in on first access.
+static int pcd_runtime_resume(struct device* dev)
+{
+  struct pcdev_private_data* dev_data = dev_get_drvdata(dev);
+
+  pcd_reclaim_resume(dev_data);
+  dev_dbg(dev, "Runtime resume\n");
+
+  return 0;
 }
 
 // Called when matched platform device is found
 static int pcd_platform_driver_probe(struct platform_device* pdev)
 {
   struct device* dev = &pdev->dev;
+  struct device* pcd_dev;
   int ret;
   struct pcdev_private_data* dev_data;
   struct pcdev_platform_data* pdata;
@@ -202,15 +458,33 @@ static int pcd_platform_driver_probe(struct platform_device* pdev)
     return -EINVAL;
   }
 
-  // Dynamically allocate memory for the device private data
-  dev_data = devm_kzalloc(dev, sizeof(*dev_data), GFP_KERNEL);
+  // Dynamically allocate memory for the device private data. Not devm, open
+  // files may still point at it after the device is gone.
+  dev_data = kzalloc(sizeof(*dev_data), GFP_KERNEL);
   if (!dev_data) {
     dev_info(dev, "Cannot allocate memory\n");
     return -ENOMEM;
   }
+  kref_init(&dev_data->ref);
+  mutex_init(&dev_data->resize_lock);
+  mutex_init(&dev_data->resize_gp_lock);
+  dev_data->dev = get_device(dev);
+
+  ret = init_srcu_struct(&dev_data->srcu);
+  if (ret) {
+    put_device(dev);
+    kfree(dev_data);
+    return ret;
+  }
+
+  // From here on the last put releases everything set up in dev_data
+  ret = devm_add_action_or_reset(dev, pcdev_put_action, dev_data);
+  if (ret) {
+    return ret;
+  }
 
   // Save the device private data pointer in platform device structure
-  dev_set_drvdata(pdev->dev, dev_data);
+  dev_set_drvdata(dev, dev_data);
 
   dev_data->pdata.size = pdata->size;
   dev_data->pdata.perm = pdata->perm;
@@ -225,54 +499,97 @@ static int pcd_platform_driver_probe(struct platform_device* pdev)
 
   // Dynamically allocate memory for the device buffer using
   // size information from the platform data
-  dev_data->buf = devm_kzalloc(dev, sizeof(dev_data->pdata.size), GFP_KERNEL);
-  if (!dev_data->buf) {
+  RCU_INIT_POINTER(dev_data->buf, pcd_buf_alloc(dev_data->pdata.size));
+  if (!rcu_access_pointer(dev_data->buf)) {
     dev_info(dev, "Cannot allocate memory\n");
     return -ENOMEM;
   }
 
+  // Lowest free id, so a removed device's minor is reused instead of
+  // colliding with a live one
+  mutex_lock(&pcdrv_data.devices_lock);
+  ret = xa_alloc(&pcdrv_data.devices, &dev_data->id, dev_data, XA_LIMIT(0, MAX_DEVICES - 1), GFP_KERNEL);
+  mutex_unlock(&pcdrv_data.devices_lock);
+  if (ret) {
+    dev_err(dev, "No free device id\n");
+    return ret;
+  }
+
   // Get the device number
-  dev_data->device_num = pcdrv_data.device_num_base + pcdrv_data.total_devices;
+  dev_data->device_num = pcdrv_data.device_num_base + dev_data->id;
   
-  // Do cdev init and cdev add
-  cdev_init(&dev_data->chdev, &pcd_fops);
-  dev_data->chdev.owner = THIS_MODULE;
+  // Do cdev alloc and cdev add
+  dev_data->chdev = cdev_alloc();
+  if (!dev_data->chdev) {
+    ret = -ENOMEM;
+    goto erase_id;
+  }
+  dev_data->chdev->ops = &pcd_fops;
+  dev_data->chdev->owner = THIS_MODULE;
 
-  ret = cdev_add(&dev_data->chdev, dev_data->device_num, 1);
+  ret = cdev_add(dev_data->chdev, dev_data->device_num, 1);
   if (ret < 0) {
     dev_err(dev, "Cdev add failed\n");
-    return ret;
+    goto cdev_del;
   }
 
   // Create device file for the detected platform device
-  pcdrv_data.pcd_device = device_create(pcdrv_data.pcd_class, dev, dev_data->device_num, NULL, "pcdev-%d", pcdrv_data.total_devices);
-  if (IS_ERR(pcdrv_data.pcd_dev)) {
+  pcd_dev = device_create_with_groups(pcdrv_data.pcd_class, dev, dev_data->device_num, NULL, pcd_attr_groups,
+                                      "pcdev-%u", dev_data->id);
+  if (IS_ERR(pcd_dev)) {
     dev_err(dev, "Device create failed\n");
-    ret = PTR_ERR(pcdrv_data.pcd_dev);
-    cdev_del(&dev_data->cdev);
-    return ret;
+    ret = PTR_ERR(pcd_dev);
+    goto cdev_del;
   }
 
-  pcdrv_data.total_devices++;
+  pcd_reclaim_add(dev_data);
 
-  ret = pcd_sysfs_create_files(pcdrv_data.pcd_device);
-  if (ret) {
-    device_destroy(pcdrv_data.pcd_class, dev_data->device_num);
-    return ret;
-  }
+  // Starts out active and suspends once nobody has opened it for the delay
+  pm_runtime_set_autosuspend_delay(dev, autosuspend_delay_ms);
+  pm_runtime_use_autosuspend(dev);
+  pm_runtime_set_active(dev);
+  pm_runtime_enable(dev);
+  pm_runtime_mark_last_busy(dev);
+  pm_request_autosuspend(dev);
 
   dev_info(dev, "Probe was successful\n");
 
   return 0;
+
+cdev_del:
+  // Also drops the reference of cdev_alloc()
+  cdev_del(dev_data->chdev);
+erase_id:
+  mutex_lock(&pcdrv_data.devices_lock);
+  xa_erase(&pcdrv_data.devices, dev_data->id);
+  mutex_unlock(&pcdrv_data.devices_lock);
+  return ret;
 }
 
 // Called when the device is removed from the system
 static int pcd_platform_driver_remove(struct platform_device* pdev)
 {
   struct pcdev_private_data* dev_data = dev_get_drvdata(&pdev->dev);
+
+  pm_runtime_disable(&pdev->dev);
+  pm_runtime_dont_use_autosuspend(&pdev->dev);
+  pm_runtime_set_suspended(&pdev->dev);
+
+  // Out of netlink's sight before anything goes away
+  mutex_lock(&pcdrv_data.devices_lock);
+  xa_erase(&pcdrv_data.devices, dev_data->id);
+  mutex_unlock(&pcdrv_data.devices_lock);
+
+  pcd_reclaim_del(dev_data);
+
   device_destroy(pcdrv_data.pcd_class, dev_data->device_num);
-  cdev_del(&dev_data->cdev);
-  pcdrv_data.total_devices--;
+  cdev_del(dev_data->chdev);
+
+  // The buffer and SRCU state go with the last reference, files still open
+  // from now on get -ENODEV
+  mutex_lock(&dev_data->resize_lock);
+  dev_data->gone = true;
+  mutex_unlock(&dev_data->resize_lock);
 
   dev_info(&pdev->dev, "Device removed\n");
 
@@ -12,17 +12,23 @@
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/srcu.h>
+#include <linux/list.h>
+#include <linux/pm_runtime.h>
+#include <linux/xarray.h>
+#include <linux/kref.h>
 #include <platform.h>
 
 // Format every pr_* message with the current running function name
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt,__func__
 
-static int pcd_open(struct inode* inod, struct file* filp);
-static int pcd_release(struct inode* inod, struct file* filp);
-static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos);
-static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos);
-static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence);
+int pcd_open(struct inode* inod, struct file* filp);
+int pcd_release(struct inode* inod, struct file* filp);
+ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos);
+ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos);
+loff_t pcd_lseek(struct file* filp, loff_t offset, int whence);
+long pcd_ioctl(struct file* filp, unsigned int cmd, unsigned long arg);
 static int pcd_platform_driver_probe(struct platform_device* pdev);
 static int pcd_platform_driver_remove(struct platform_device* pdev);
 
@@ -40,18 +46,82 @@ struct device_config {
 
 // Driver private data structure
 static const struct pcdrv_private_data {
-  int total_devices;
+  struct xarray devices; // By device id, the N of pcdev-N
+  struct mutex devices_lock; // Keeps a device around while netlink looks at it
   dev_t device_num_base;
   struct class* pcd_class;
-  struct device* pcd_dev;
 };
 
-// Device private data structure
+struct pcd_zpage;
+
+// Device buffer built from individually allocated pages. A resize publishes a new
+// pcd_buf that shares (and takes a reference on) every page both sizes have in common.
+struct pcd_buf {
+  size_t size;
+  unsigned long nr_pages;
+  struct page** pages;        // NULL while the page is reclaimed
+  struct pcd_zpage** zpages;  // Compressed reclaimed pages, NULL if it held only zeroes
+  unsigned long nr_reclaimed; // Changed under resize_lock
+};
+
+// Device private data structure. Open files hold a reference, so it and the
+// buffer outlive the platform device; gone tells them it was removed.
 static const struct pcdev_private_data {
+  struct kref ref;
+  bool gone; // Removed, set under resize_lock
   struct pcdev_platform_data pdata;
-  char *buf;
+  struct pcd_buf __rcu* buf; // Read under srcu, replaced under resize_lock
+  struct srcu_struct srcu;
+  struct mutex resize_lock; // Also keeps reclaim away from users and from resizes
+  struct mutex resize_gp_lock; // One resize at a time, up to the end of its grace period
   dev_t device_num;
-  struct cdev chdev;
+  struct cdev* chdev; // Allocated, an open file's inode still points at it after remove
+  u32 id;
+  struct device* dev; // The platform device, for runtime PM, referenced
+  struct list_head node; // On the reclaim list
+  unsigned int users; // Open files and sysfs accesses, under resize_lock
+  bool suspended; // Runtime suspended and reclaimable, under resize_lock
+  atomic_long_t reclaimed;
+  atomic_long_t refaulted;
 };
 
+extern struct pcdrv_private_data pcdrv_data;
+
+void pcdev_put(struct pcdev_private_data* dev_data);
+
+// pcd_buffer.c
+struct pcd_buf* pcd_buf_alloc(size_t size);
+void pcd_buf_free(struct pcd_buf* buf);
+int pcd_buf_resize(struct pcdev_private_data* dev_data, size_t size);
+struct page* pcd_buf_get_page(struct pcdev_private_data* dev_data, struct pcd_buf* buf, unsigned long idx);
+int pcd_buf_fault_all(struct pcdev_private_data* dev_data, struct pcd_buf* buf);
+int pcd_buf_copy_to_user(struct pcdev_private_data* dev_data, struct pcd_buf* buf, char __user* buff, size_t count, loff_t pos);
+int pcd_buf_copy_from_user(struct pcdev_private_data* dev_data, struct pcd_buf* buf, const char __user* buff, size_t count, loff_t pos);
+int pcd_buf_copy_out(struct pcdev_private_data* dev_data, struct pcd_buf* buf, void* dst, size_t count, loff_t pos);
+int pcd_buf_copy_in(struct pcdev_private_data* dev_data, struct pcd_buf* buf, const void* src, size_t count, loff_t pos);
+
+// pcd_reclaim.c
+int pcd_reclaim_init(void);
+void pcd_reclaim_exit(void);
+void pcd_reclaim_add(struct pcdev_private_data* dev_data);
+void pcd_reclaim_del(struct pcdev_private_data* dev_data);
+void pcd_reclaim_get(struct pcdev_private_data* dev_data);
+void pcd_reclaim_put(struct pcdev_private_data* dev_data);
+void pcd_reclaim_suspend(struct pcdev_private_data* dev_data);
+void pcd_reclaim_resume(struct pcdev_private_data* dev_data);
+struct page* pcd_reclaim_fault_locked(struct pcdev_private_data* dev_data, struct pcd_buf* buf, unsigned long idx);
+void pcd_reclaim_free(struct pcd_buf* buf);
+
+// pcd_netlink.c
+int pcd_netlink_init(void);
+void pcd_netlink_exit(void);
+void pcd_netlink_notify(struct pcdev_private_data* dev_data);
+
+// pcd_dmabuf.c
+int pcd_dmabuf_export(struct pcdev_private_data* dev_data, bool writable, bool cloexec);
+
+// pcd_configfs.c
+int pcd_configfs_init(void);
+void pcd_configfs_exit(void);
+
 #endif // PCD_PLATFORM_DRIVER_DT_SYSFS_H
@@ -0,0 +1,278 @@
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/shrinker.h>
+#include <linux/lzo.h>
+#include <linux/string.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+
+// Runtime suspended devices give their buffer pages back under memory pressure,
+// suspend is what marks a device idle. A reclaimed page
+// is LZO compressed into a small kmalloc blob (or dropped altogether if it only held
+// zeroes) and its slot in pcd_buf->pages is cleared; the next access through
+// pcd_buf_get_page() decompresses it into a fresh page. Needs CONFIG_LZO_COMPRESS
+// and CONFIG_LZO_DECOMPRESS.
+
+// Pages that don't compress below this are left resident, it's not worth the refault
+#define PCD_ZPAGE_MAX_LEN (PAGE_SIZE - PAGE_SIZE / 4)
+
+struct pcd_zpage {
+  size_t len;
+  u8 data[];
+};
+
+// Devices eligible for reclaim, scanned round robin. The lock also serialises use
+// of the compression scratch buffers.
+static LIST_HEAD(pcd_reclaim_devices);
+static DEFINE_MUTEX(pcd_reclaim_lock);
+static void* pcd_zwrkmem;
+static u8* pcd_zdst;
+
+static bool pcd_reclaim_idle(struct pcdev_private_data* dev_data)
+{
+  return READ_ONCE(dev_data->suspended) && !READ_ONCE(dev_data->users);
+}
+
+// Called on runtime suspend, the device's pages are fair game from now on
+void pcd_reclaim_suspend(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&dev_data->resize_lock);
+  WRITE_ONCE(dev_data->suspended, true);
+  mutex_unlock(&dev_data->resize_lock);
+}
+
+// Called on runtime resume, before the access that woke the device
+void pcd_reclaim_resume(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&dev_data->resize_lock);
+  WRITE_ONCE(dev_data->suspended, false);
+  mutex_unlock(&dev_data->resize_lock);
+}
+
+void pcd_reclaim_get(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&dev_data->resize_lock);
+  dev_data->users++;
+  mutex_unlock(&dev_data->resize_lock);
+}
+
+void pcd_reclaim_put(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&dev_data->resize_lock);
+  dev_data->users--;
+  mutex_unlock(&dev_data->resize_lock);
+}
+
+// Brings a reclaimed page back, with resize_lock held
+struct page* pcd_reclaim_fault_locked(struct pcdev_private_data* dev_data, struct pcd_buf* buf, unsigned long idx)
+{
+  struct pcd_zpage* zpage = buf->zpages[idx];
+  struct page* page;
+  size_t len = PAGE_SIZE;
+
+  if (buf->pages[idx]) {
+    return buf->pages[idx];
+  }
+
+  page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+  if (!page) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  if (zpage) {
+    if (lzo1x_decompress_safe(zpage->data, zpage->len, page_address(page), &len) != LZO_E_OK ||
+        len != PAGE_SIZE) {
+      __free_page(page);
+      return ERR_PTR(-EIO);
+    }
+    kfree(zpage);
+    buf->zpages[idx] = NULL;
+  }
+
+  buf->nr_reclaimed--;
+  atomic_long_inc(&dev_data->refaulted);
+
+  // Pairs with the READ_ONCE() in pcd_buf_get_page(), the contents must be
+  // visible before the page is
+  smp_store_release(&buf->pages[idx], page);
+
+  return page;
+}
+
+// Compresses one page out of the buffer. Returns false if it has to stay resident.
+static bool pcd_reclaim_page(struct pcd_buf* buf, unsigned long idx, gfp_t gfp)
+{
+  struct page* page = buf->pages[idx];
+  struct pcd_zpage* zpage = NULL;
+  void* addr = page_address(page);
+  size_t len;
+
+  // Mapped through the contents attribute or still shared with a buffer being
+  // retired by a resize: someone else can see this page, leave it alone
+  if (page_mapped(page) || page_count(page) != 1) {
+    return false;
+  }
+
+  if (memchr_inv(addr, 0, PAGE_SIZE)) {
+    if (lzo1x_1_compress(addr, PAGE_SIZE, pcd_zdst, &len, pcd_zwrkmem) != LZO_E_OK ||
+        len > PCD_ZPAGE_MAX_LEN) {
+      return false;
+    }
+
+    zpage = kmalloc(struct_size(zpage, data, len), gfp);
+    if (!zpage) {
+      return false;
+    }
+    zpage->len = len;
+    memcpy(zpage->data, pcd_zdst, len);
+  }
+
+  buf->zpages[idx] = zpage;
+  WRITE_ONCE(buf->pages[idx], NULL);
+  buf->nr_reclaimed++;
+  put_page(page);
+
+  return true;
+}
+
+static unsigned long pcd_reclaim_count(struct shrinker* shrinker, struct shrink_control* sc)
+{
+  struct pcdev_private_data* dev_data;
+  struct pcd_buf* buf;
+  unsigned long count = 0;
+  int idx;
+
+  if (!mutex_trylock(&pcd_reclaim_lock)) {
+    return 0;
+  }
+
+  list_for_each_entry(dev_data, &pcd_reclaim_devices, node) {
+    if (!pcd_reclaim_idle(dev_data)) {
+      continue;
+    }
+
+    idx = srcu_read_lock(&dev_data->srcu);
+    buf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+    count += buf->nr_pages - READ_ONCE(buf->nr_reclaimed);
+    srcu_read_unlock(&dev_data->srcu, idx);
+  }
+
+  mutex_unlock(&pcd_reclaim_lock);
+
+  return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long pcd_reclaim_scan(struct shrinker* shrinker, struct shrink_control* sc)
+{
+  struct pcdev_private_data* dev_data;
+  struct pcdev_private_data* tmp;
+  struct pcd_buf* buf;
+  unsigned long freed = 0;
+  unsigned long i;
+  LIST_HEAD(scanned);
+
+  // Reclaim can be entered from our own allocations, which hold these locks
+  if (!mutex_trylock(&pcd_reclaim_lock)) {
+    return SHRINK_STOP;
+  }
+
+  list_for_each_entry_safe(dev_data, tmp, &pcd_reclaim_devices, node) {
+    if (!sc->nr_to_scan) {
+      break;
+    }
+
+    if (!pcd_reclaim_idle(dev_data) || !mutex_trylock(&dev_data->resize_lock)) {
+      continue;
+    }
+
+    // Users and resumes only happen under resize_lock, so nobody can be
+    // reading the pages from here on
+    if (dev_data->suspended && !dev_data->users) {
+      buf = rcu_dereference_protected(dev_data->buf, lockdep_is_held(&dev_data->resize_lock));
+
+      for (i = 0; i < buf->nr_pages && sc->nr_to_scan; i++) {
+        if (!buf->pages[i]) {
+          continue;
+        }
+        sc->nr_to_scan--;
+
+        // We are in reclaim, don't dig any deeper for the blob
+        if (pcd_reclaim_page(buf, i, GFP_NOWAIT | __GFP_NOWARN)) {
+          atomic_long_inc(&dev_data->reclaimed);
+          freed++;
+        }
+      }
+    }
+
+    mutex_unlock(&dev_data->resize_lock);
+
+    // Next scan starts with the devices we didn't get to
+    list_move_tail(&dev_data->node, &scanned);
+  }
+
+  list_splice_tail(&scanned, &pcd_reclaim_devices);
+
+  mutex_unlock(&pcd_reclaim_lock);
+
+  return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker pcd_shrinker = {
+  .count_objects = pcd_reclaim_count,
+  .scan_objects = pcd_reclaim_scan,
+  .seeks = DEFAULT_SEEKS,
+};
+
+void pcd_reclaim_add(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&pcd_reclaim_lock);
+  list_add_tail(&dev_data->node, &pcd_reclaim_devices);
+  mutex_unlock(&pcd_reclaim_lock);
+}
+
+void pcd_reclaim_del(struct pcdev_private_data* dev_data)
+{
+  mutex_lock(&pcd_reclaim_lock);
+  list_del(&dev_data->node);
+  mutex_unlock(&pcd_reclaim_lock);
+}
+
+// Drops the compressed copies a buffer still owns
+void pcd_reclaim_free(struct pcd_buf* buf)
+{
+  unsigned long i;
+
+  for (i = 0; i < buf->nr_pages; i++) {
+    kfree(buf->zpages[i]);
+  }
+}
+
+int pcd_reclaim_init(void)
+{
+  int ret;
+
+  pcd_zwrkmem = kvmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+  pcd_zdst = kvmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+  if (!pcd_zwrkmem || !pcd_zdst) {
+    ret = -ENOMEM;
+    goto free_scratch;
+  }
+
+  ret = register_shrinker(&pcd_shrinker, "pcd-sysfs");
+  if (ret) {
+    goto free_scratch;
+  }
+
+  return 0;
+
+free_scratch:
+  kvfree(pcd_zdst);
+  kvfree(pcd_zwrkmem);
+  return ret;
+}
+
+void pcd_reclaim_exit(void)
+{
+  unregister_shrinker(&pcd_shrinker);
+  kvfree(pcd_zdst);
+  kvfree(pcd_zwrkmem);
+}
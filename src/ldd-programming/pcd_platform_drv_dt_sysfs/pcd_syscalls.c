@@ -1,4 +1,5 @@
 #include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_ioctl.h"
 
 static int check_permission(int dev_perm, int access_mode)
 {
@@ -17,27 +18,211 @@ static int check_permission(int dev_perm, int access_mode)
   return -EPERM;
 }
 
-static loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
+loff_t pcd_lseek(struct file* filp, loff_t offset, int whence)
 {
-  return 0;
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+  loff_t max_size = READ_ONCE(dev_data->pdata.size);
+  loff_t temp;
+
+  if (READ_ONCE(dev_data->gone)) {
+    return -ENODEV;
+  }
+
+  switch(whence) {
+    case SEEK_SET:
+      temp = offset;
+      break;
+    case SEEK_CUR:
+      temp = filp->f_pos + offset;
+      break;
+    case SEEK_END:
+      temp = max_size + offset;
+      break;
+    default:
+      return -EINVAL;
+  }
+
+  if (temp > max_size || temp < 0) {
+    return -EINVAL;
+  }
+  filp->f_pos = temp;
+
+  return filp->f_pos;
+}
+
+// Reads and writes never take a lock. They run against whichever buffer is
+// published when they start; a concurrent max_size change waits for them
+// (synchronize_srcu) before releasing that buffer. Only a page that was
+// reclaimed while the device sat idle costs a trip through resize_lock.
+ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
+{
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+  struct pcd_buf* buf;
+  ssize_t ret;
+  int idx;
+
+  if (READ_ONCE(dev_data->gone)) {
+    return -ENODEV;
+  }
+
+  idx = srcu_read_lock(&dev_data->srcu);
+  buf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+
+  if (*f_pos >= buf->size) {
+    srcu_read_unlock(&dev_data->srcu, idx);
+    return 0;
+  }
+
+  if ((*f_pos + count) > buf->size) {
+    count = buf->size - *f_pos;
+  }
+
+  ret = pcd_buf_copy_to_user(dev_data, buf, buff, count, *f_pos);
+
+  srcu_read_unlock(&dev_data->srcu, idx);
+
+  if (ret) {
+    return ret;
+  }
+
+  *f_pos += count;
+
+  return count;
+}
+
+ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
+{
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+  struct pcd_buf* buf;
+  ssize_t ret;
+  int idx;
+
+  if (READ_ONCE(dev_data->gone)) {
+    return -ENODEV;
+  }
+
+  idx = srcu_read_lock(&dev_data->srcu);
+  buf = srcu_dereference(dev_data->buf, &dev_data->srcu);
+
+  if ((*f_pos + count) > buf->size) {
+    count = (*f_pos < buf->size) ? buf->size - *f_pos : 0;
+  }
+
+  if (!count) {
+    srcu_read_unlock(&dev_data->srcu, idx);
+    pr_err("No space left on the device\n");
+    return -ENOMEM;
+  }
+
+  ret = pcd_buf_copy_from_user(dev_data, buf, buff, count, *f_pos);
+
+  srcu_read_unlock(&dev_data->srcu, idx);
+
+  if (ret) {
+    return ret;
+  }
+
+  *f_pos += count;
+
+  return count;
 }
 
-static ssize_t pcd_read(struct file* filp, char __user* buff, size_t count, loff_t* f_pos)
+static long pcd_ioctl_export_dmabuf(struct file* filp, struct pcd_dmabuf_export __user* uarg)
 {
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+  struct pcd_dmabuf_export arg;
+  int fd;
+
+  if (copy_from_user(&arg, uarg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
+  if (arg.flags & ~PCD_DMABUF_CLOEXEC) {
+    return -EINVAL;
+  }
+
+  if (READ_ONCE(dev_data->gone)) {
+    return -ENODEV;
+  }
+
+  // The dma-buf gets no more access than this fd has
+  fd = pcd_dmabuf_export(dev_data, filp->f_mode & FMODE_WRITE, arg.flags & PCD_DMABUF_CLOEXEC);
+  if (fd < 0) {
+    return fd;
+  }
+
+  // Too late to take the fd back once it is installed, so a bad pointer here
+  // just leaks it to the process like any other fd
+  arg.fd = fd;
+  if (copy_to_user(uarg, &arg, sizeof(arg))) {
+    return -EFAULT;
+  }
+
   return 0;
 }
 
-static ssize_t pcd_write(struct file* filp, const char __user* buff, size_t count, loff_t* f_pos)
+long pcd_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
 {
-  return -ENOMEM;
+  switch (cmd) {
+    case PCD_IOC_EXPORT_DMABUF:
+      return pcd_ioctl_export_dmabuf(filp, (struct pcd_dmabuf_export __user*)arg);
+    default:
+      return -ENOTTY;
+  }
 }
 
-static int pcd_open(struct inode* inod, struct file* filp)
+int pcd_open(struct inode* inod, struct file* filp)
 {
+  struct pcdev_private_data* dev_data;
+
+  int ret;
+
+  // The cdev may outlive the device, so look it up by minor. The reference is
+  // taken under xa_lock, remove erases the entry before it lets go of its own.
+  xa_lock(&pcdrv_data.devices);
+  dev_data = xa_load(&pcdrv_data.devices, MINOR(inod->i_rdev) - MINOR(pcdrv_data.device_num_base));
+  if (dev_data) {
+    kref_get(&dev_data->ref);
+  }
+  xa_unlock(&pcdrv_data.devices);
+
+  if (!dev_data) {
+    return -ENODEV;
+  }
+
+  ret = check_permission(dev_data->pdata.perm, filp->f_mode);
+  if (ret) {
+    goto put;
+  }
+
+  // Wakes a suspended device, fails once remove has disabled runtime PM
+  ret = pm_runtime_resume_and_get(dev_data->dev);
+  if (ret < 0) {
+    goto put;
+  }
+
+  // Keeps the shrinker off the device until the last release
+  pcd_reclaim_get(dev_data);
+
+  filp->private_data = dev_data;
+
   return 0;
+
+put:
+  pcdev_put(dev_data);
+  return ret;
 }
 
-static int pcd_release(struct inode* inod, struct file* filp)
+int pcd_release(struct inode* inod, struct file* filp)
 {
+  struct pcdev_private_data* dev_data = (struct pcdev_private_data*)filp->private_data;
+
+  pcd_reclaim_put(dev_data);
+
+  pm_runtime_mark_last_busy(dev_data->dev);
+  pm_runtime_put_autosuspend(dev_data->dev);
+
+  pcdev_put(dev_data);
+
   return 0;
 }